@@ -0,0 +1,36 @@
+//
+// Created by ZhangHao on 2022/12/4.
+//
+
+#ifndef CFD_2D_BOUNDARY_H
+#define CFD_2D_BOUNDARY_H
+
+#include "Vec.h"
+
+class BoundaryI {
+public:
+    virtual void updateCS(float top, float bottom, float right, float left) = 0;
+    // prev_pos : current position of the particle
+    // next_pos : check next position with the boundary
+    // vel : particle velocity, updated when the particle bounces
+    // return true if the position update should be rejected
+    virtual bool updateAt(vec2 prev_pos, vec2 next_pos, vec2 &vel) = 0;
+    virtual bool isSeperated(vec2 a, vec2 b) = 0;
+
+    // axis aligned box holding the boundary, false if it is unbounded
+    virtual bool bounds(vec2 &lower, vec2 &upper) {
+        return false;
+    }
+
+    // false only if the boundary surely does not cross the box [lower, upper]
+    virtual bool overlaps(vec2 lower, vec2 upper) {
+        return true;
+    }
+
+    // true only if isSeperated(a, b) is true for every a in box a and b in box b
+    virtual bool blocks(vec2 lower_a, vec2 upper_a, vec2 lower_b, vec2 upper_b) {
+        return false;
+    }
+};
+
+#endif //CFD_2D_BOUNDARY_H
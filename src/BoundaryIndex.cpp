@@ -0,0 +1,121 @@
+//
+// Created by ZhangHao on 2022/12/13.
+//
+
+#include "BoundaryIndex.h"
+#include <algorithm>
+
+// block widening in cells
+static const float margin = 1e-3f;
+
+void BoundaryIndex::build(const std::vector<std::shared_ptr<BoundaryI>> &boundaries,
+                          float l, float b, float cell_size, int r) {
+    left = l;
+    bottom = b;
+    h = cell_size;
+    block_reach = r;
+    all.clear();
+    unbounded.clear();
+    for (auto &boundary : boundaries) {
+        all.push_back(boundary.get());
+    }
+
+    // box of cells around the bounded boundaries, in cells of the particle grid
+    x0 = y0 = 0;
+    int x1 = -1, y1 = -1;
+    bool first = true;
+    for (BoundaryI *boundary : all) {
+        vec2 lower, upper;
+        if (!boundary->bounds(lower, upper)) {
+            unbounded.push_back(boundary);
+            continue;
+        }
+        int lx = to_cell((lower.x() - left) / h) - block_reach, ly = to_cell((lower.y() - bottom) / h) - block_reach;
+        int ux = to_cell((upper.x() - left) / h) + block_reach, uy = to_cell((upper.y() - bottom) / h) + block_reach;
+        x0 = first ? lx : std::min(x0, lx);
+        y0 = first ? ly : std::min(y0, ly);
+        x1 = first ? ux : std::max(x1, ux);
+        y1 = first ? uy : std::max(y1, uy);
+        first = false;
+    }
+    grid_col = x1 - x0 + 1;
+    grid_raw = y1 - y0 + 1;
+    int cells = grid_col * grid_raw;
+
+    // cells whose block a boundary crosses, as (cell, boundary) pairs
+    std::vector<std::pair<int, int>> hits;
+    for (int k = 0; k < int(all.size()); k++) {
+        int cx0 = 0, cy0 = 0, cx1 = grid_col - 1, cy1 = grid_raw - 1;
+        vec2 lower, upper;
+        if (all[k]->bounds(lower, upper)) {
+            cx0 = std::max(cx0, cellX(lower.x()) - block_reach);
+            cy0 = std::max(cy0, cellY(lower.y()) - block_reach);
+            cx1 = std::min(cx1, cellX(upper.x()) + block_reach);
+            cy1 = std::min(cy1, cellY(upper.y()) + block_reach);
+        }
+        for (int y = cy0; y <= cy1; y++) {
+            for (int x = cx0; x <= cx1; x++) {
+                // widened a little, points on the block border are still covered after rounding
+                vec2 block_lower, block_upper, unused;
+                cellBox(x - block_reach, y - block_reach, block_lower, unused);
+                cellBox(x + block_reach, y + block_reach, unused, block_upper);
+                if (all[k]->overlaps(block_lower - margin * h, block_upper + margin * h)) {
+                    hits.emplace_back(y * grid_col + x, k);
+                }
+            }
+        }
+    }
+
+    // counting sort by cell, boundaries keep their order inside a cell
+    cell_start.assign(cells + 1, 0);
+    for (auto &hit : hits) {
+        cell_start[hit.first + 1]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        cell_start[c + 1] += cell_start[c];
+    }
+    cell_items.resize(hits.size());
+    std::vector<int> offset(cell_start.begin(), cell_start.end() - 1);
+    for (auto &hit : hits) {
+        cell_items[offset[hit.first]++] = all[hit.second];
+    }
+
+    // neighbour masks, from the lists
+    visibility.resize(cells);
+    for (int y = 0; y < grid_raw; y++) {
+        for (int x = 0; x < grid_col; x++) {
+            visibility[y * grid_col + x] = cell_visibility(x, y);
+        }
+    }
+}
+
+unsigned int BoundaryIndex::cell_visibility(int x, int y) const {
+    int c = y * grid_col + x;
+    unsigned int mask = 0;
+    vec2 lower, upper;
+    cellBox(x, y, lower, upper);
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            vec2 other_lower, other_upper;
+            cellBox(x + dx, y + dy, other_lower, other_upper);
+            // box of both cells, widened like the blocks
+            float pad = margin * h;
+            vec2 box_lower(std::min(lower.x(), other_lower.x()) - pad, std::min(lower.y(), other_lower.y()) - pad);
+            vec2 box_upper(std::max(upper.x(), other_upper.x()) + pad, std::max(upper.y(), other_upper.y()) + pad);
+            unsigned int v = VISIBLE;
+            for (int k = cell_start[c]; k < cell_start[c + 1]; k++) {
+                BoundaryI *boundary = cell_items[k];
+                if (!boundary->overlaps(box_lower, box_upper)) {
+                    continue;
+                }
+                if (boundary->blocks(lower, upper, other_lower, other_upper)) {
+                    v = BLOCKED;
+                    break;
+                }
+                v = EXACT;
+            }
+            mask |= v << (2 * ((dy + 1) * 3 + dx + 1));
+        }
+    }
+    return mask;
+}
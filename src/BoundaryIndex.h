@@ -0,0 +1,119 @@
+//
+// Created by ZhangHao on 2022/12/13.
+//
+
+#ifndef CFD_2D_BOUNDARY_INDEX_H
+#define CFD_2D_BOUNDARY_INDEX_H
+
+#include "Boundary.h"
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// boundaries sorted into the cells of the particle grid, over the box of cells
+// around the bounded boundaries. Outside of it only unbounded boundaries are tested.
+// Cell c lists every boundary crossing the block of cells within reach of c,
+// so a segment between two points whose cells are at most reach apart can only
+// cross the boundaries of the first point's cell. Cells far from any wall list nothing.
+// Every cell also keeps a 3 x 3 mask telling for each neighbour cell if all segments
+// to it are free, all are blocked, or they need the exact test
+class BoundaryIndex {
+public:
+    // visibility of a neighbour cell, 2 bits per neighbour in the mask
+    enum Visibility {
+        VISIBLE = 0,
+        BLOCKED = 1,
+        EXACT = 2
+    };
+
+    // index boundaries over cells of size h, cell (0, 0) starts at (left, bottom)
+    void build(const std::vector<std::shared_ptr<BoundaryI>> &boundaries,
+               float left, float bottom, float h, int reach);
+
+    int reach() const {
+        return block_reach;
+    }
+
+    // same as asking every boundary
+    inline bool isSeperated(vec2 a, vec2 b) const {
+        if (all.empty()) {
+            return false;
+        }
+        int ax = cellX(a.x()), ay = cellY(a.y());
+        int bx = cellX(b.x()), by = cellY(b.y());
+        BoundaryI *const *first = all.data(), *const *last = all.data() + all.size();
+        int dx = bx - ax, dy = by - ay;
+        if (std::abs(dx) <= block_reach && std::abs(dy) <= block_reach) {
+            if (inGrid(ax, ay)) {
+                int c = ay * grid_col + ax;
+                if (std::abs(dx) <= 1 && std::abs(dy) <= 1) {
+                    unsigned int v = (visibility[c] >> (2 * ((dy + 1) * 3 + dx + 1))) & 3u;
+                    if (v != EXACT) {
+                        return v == BLOCKED;
+                    }
+                }
+                first = cell_items.data() + cell_start[c];
+                last = cell_items.data() + cell_start[c + 1];
+            } else {
+                first = unbounded.data();
+                last = unbounded.data() + unbounded.size();
+            }
+        }
+        for (; first != last; first++) {
+            if ((*first)->isSeperated(a, b)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    // the indexed box is cols x rows cells from cell (x0, y0)
+    int x0{0};
+    int y0{0};
+    int grid_col{0};
+    int grid_raw{0};
+    float left{0};
+    float bottom{0};
+    float h{1};
+    int block_reach{1};
+
+    // cell c holds cell_items[cell_start[c]] ... cell_items[cell_start[c + 1] - 1]
+    std::vector<int> cell_start;
+    std::vector<BoundaryI *> cell_items;
+    // Visibility of the 3 x 3 neighbours of each cell, neighbour (dx, dy) at bits
+    // 2 * ((dy + 1) * 3 + dx + 1)
+    std::vector<unsigned int> visibility;
+    // all boundaries, for points further apart than reach
+    std::vector<BoundaryI *> all;
+    // boundaries without bounds, for points outside the box
+    std::vector<BoundaryI *> unbounded;
+
+    // cell coordinates relative to the indexed box
+    inline int cellX(float x) const {
+        return to_cell((x - left) / h) - x0;
+    }
+
+    inline int cellY(float y) const {
+        return to_cell((y - bottom) / h) - y0;
+    }
+
+    static inline int to_cell(float f) {
+        return int(std::max(-float(1 << 30), std::min(float(1 << 30), std::floor(f))));
+    }
+
+    // lower and upper corner of cell (x, y) of the box
+    inline void cellBox(int x, int y, vec2 &lower, vec2 &upper) const {
+        lower = vec2(left + float(x0 + x) * h, bottom + float(y0 + y) * h);
+        upper = vec2(left + float(x0 + x + 1) * h, bottom + float(y0 + y + 1) * h);
+    }
+
+    // mask of cell (x, y), from its own list
+    unsigned int cell_visibility(int x, int y) const;
+
+    inline bool inGrid(int x, int y) const {
+        return x < grid_col && x >= 0 && y < grid_raw && y >= 0;
+    }
+};
+
+#endif //CFD_2D_BOUNDARY_INDEX_H
@@ -0,0 +1,295 @@
+//
+// Created by ZhangHao on 2022/12/8.
+//
+
+#include "CellGrid.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+// particles handled by one counting sort chunk at least
+static const int min_chunk_size = 4096;
+// upper bound of chunks * cells, limits the histogram memory
+static const size_t max_histogram_size = size_t(1) << 24;
+// hashed cell coordinates stay below this
+static const float max_cell = 1 << 30;
+
+void CellGrid::resize(int cols, int rows, float l, float b, float cell_size) {
+    hashed = false;
+    grid_col = cols;
+    grid_raw = rows;
+    left = l;
+    bottom = b;
+    h = cell_size;
+    cell_start.assign(size_t(grid_col) * grid_raw + 1, 0);
+    sorted.clear();
+    particle_cell.clear();
+}
+
+void CellGrid::resizeHashed(float l, float b, float cell_size) {
+    hashed = true;
+    grid_col = 0;
+    grid_raw = 0;
+    left = l;
+    bottom = b;
+    h = cell_size;
+    cell_start.assign(1, 0);
+    sorted.clear();
+    particle_cell.clear();
+    occupied_cells.clear();
+    table.assign(1, -1);
+}
+
+void CellGrid::build(const float *x, const float *y, int count, nano_std::ThreadPool *pool) {
+    if (hashed) {
+        build_hashed(x, y, count, pool);
+    } else {
+        build_dense(x, y, count, pool);
+    }
+}
+
+void CellGrid::renumber(const int *order, int count, nano_std::ThreadPool *pool) {
+    renumbered.resize(count);
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        std::copy(particle_cell.begin() + first, particle_cell.begin() + last, renumbered.begin() + first);
+    });
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            particle_cell[i] = renumbered[order[i]];
+        }
+    });
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            renumbered[order[i]] = i;
+        }
+    });
+    pool->parallel_for(0, int(sorted.size()), 4096, [&](int first, int last) {
+        for (int s = first; s < last; s++) {
+            sorted[s] = renumbered[sorted[s]];
+        }
+    });
+}
+
+void CellGrid::build_dense(const float *x, const float *y, int count, nano_std::ThreadPool *pool) {
+    int cells = grid_col * grid_raw;
+    particle_cell.resize(count);
+
+    // split particles into chunks, each chunk has its own histogram
+    int chunks = std::max(1, std::min(int(pool->size()), count / min_chunk_size));
+    chunks = std::max(1, std::min(chunks, int(max_histogram_size / std::max(cells, 1))));
+    int chunk_size = (count + chunks - 1) / chunks;
+    chunk_counts.resize(size_t(chunks) * cells);
+
+    // 1. cell of each particle and per chunk histograms
+    pool->syncChunks(chunks, [&](int t) {
+        int *histogram = chunk_counts.data() + size_t(t) * cells;
+        std::fill(histogram, histogram + cells, 0);
+        int end = std::min(count, (t + 1) * chunk_size);
+        for (int i = t * chunk_size; i < end; i++) {
+            int cell = -1;
+            float dx = x[i] - left;
+            float dy = y[i] - bottom;
+            // boundary check
+            if (dx > 0 && dy > 0) {
+                int col_index = int(std::floor(dx / h));
+                int raw_index = int(std::floor(dy / h));
+                if (inGrid(col_index, raw_index)) {
+                    cell = raw_index * grid_col + col_index;
+                    histogram[cell]++;
+                }
+            }
+            particle_cell[i] = cell;
+        }
+    });
+
+    scatter_by_cell(count, cells, chunks, chunk_size, pool);
+
+    // non-empty cells
+    occupied_cells.clear();
+    for (int c = 0; c < cells; c++) {
+        if (cell_start[c + 1] > cell_start[c]) {
+            occupied_cells.push_back(Cell{c % grid_col, c / grid_col, c});
+        }
+    }
+}
+
+void CellGrid::scatter_by_cell(int count, int cells, int chunks, int chunk_size, nano_std::ThreadPool *pool) {
+    // prefix sum over cells, chunk t writes after chunks 0 ... t - 1 in every cell
+    int blocks = std::max(1, std::min(chunks, cells));
+    int block_size = (cells + blocks - 1) / blocks;
+    block_sums.resize(blocks + 1);
+    pool->syncChunks(blocks, [&](int b) {
+        int sum = 0;
+        int end = std::min(cells, (b + 1) * block_size);
+        for (int t = 0; t < chunks; t++) {
+            const int *histogram = chunk_counts.data() + size_t(t) * cells;
+            for (int c = b * block_size; c < end; c++) {
+                sum += histogram[c];
+            }
+        }
+        block_sums[b + 1] = sum;
+    });
+    block_sums[0] = 0;
+    for (int b = 0; b < blocks; b++) {
+        block_sums[b + 1] += block_sums[b];
+    }
+    pool->syncChunks(blocks, [&](int b) {
+        int running = block_sums[b];
+        int end = std::min(cells, (b + 1) * block_size);
+        for (int c = b * block_size; c < end; c++) {
+            cell_start[c] = running;
+            for (int t = 0; t < chunks; t++) {
+                int &slot = chunk_counts[size_t(t) * cells + c];
+                int n = slot;
+                slot = running;
+                running += n;
+            }
+        }
+    });
+    cell_start[cells] = block_sums[blocks];
+
+    // scatter, stable inside each cell
+    sorted.resize(block_sums[blocks]);
+    pool->syncChunks(chunks, [&](int t) {
+        int *offset = chunk_counts.data() + size_t(t) * cells;
+        int end = std::min(count, (t + 1) * chunk_size);
+        for (int i = t * chunk_size; i < end; i++) {
+            int cell = particle_cell[i];
+            if (cell >= 0) {
+                sorted[offset[cell]++] = i;
+            }
+        }
+    });
+}
+
+void CellGrid::build_hashed(const float *x, const float *y, int count, nano_std::ThreadPool *pool) {
+    particle_cell.resize(count);
+    int chunks = std::max(1, std::min(int(pool->size()), count / min_chunk_size));
+    int chunk_size = (count + chunks - 1) / chunks;
+
+    // 1. insert the cell key of every particle into an open addressing set, slot of each
+    // particle in particle_cell. Non finite positions are dropped. The set starts at
+    // 4 slots per cell of the last build, and grows when it gets more than half full
+    size_t capacity = std::max(table.size(), size_t(1024));
+    while (capacity < 4 * occupied_cells.size()) {
+        capacity *= 2;
+    }
+    for (;;) {
+        slot_keys.resize(capacity);
+        pool->parallel_for(0, int(capacity), 16384, [&](int first, int last) {
+            std::fill(slot_keys.begin() + first, slot_keys.begin() + last, ~0ull);
+        });
+        std::atomic<size_t> used{0};
+        std::atomic<bool> full{false};
+        size_t limit = capacity / 2;
+        pool->syncChunks(chunks, [&](int t) {
+            size_t mask = capacity - 1;
+            // particles next to each other in memory mostly share a cell
+            unsigned long long last_key = ~0ull;
+            size_t last_slot = 0;
+            int end = std::min(count, (t + 1) * chunk_size);
+            for (int i = t * chunk_size; i < end && !full.load(std::memory_order_relaxed); i++) {
+                float fx = std::floor((x[i] - left) / h);
+                float fy = std::floor((y[i] - bottom) / h);
+                if (!(std::abs(fx) < max_cell && std::abs(fy) < max_cell)) {
+                    particle_cell[i] = -1;
+                    continue;
+                }
+                unsigned long long k = key(int(fx), int(fy));
+                if (k == last_key) {
+                    particle_cell[i] = int(last_slot);
+                    continue;
+                }
+                size_t slot = hash(k) & mask;
+                for (;; slot = (slot + 1) & mask) {
+                    std::atomic_ref<unsigned long long> entry(slot_keys[slot]);
+                    unsigned long long seen = entry.load(std::memory_order_relaxed);
+                    if (seen == ~0ull && entry.compare_exchange_strong(seen, k, std::memory_order_relaxed)) {
+                        // inserting stops past the limit, the set never fills up
+                        if (used.fetch_add(1, std::memory_order_relaxed) + 1 > limit) {
+                            full.store(true, std::memory_order_relaxed);
+                        }
+                        break;
+                    }
+                    if (seen == k) {
+                        break;
+                    }
+                }
+                particle_cell[i] = int(slot);
+                last_key = k;
+                last_slot = slot;
+            }
+        });
+        if (!full.load()) {
+            break;
+        }
+        capacity *= 4;
+    }
+
+    // 2. occupied slots sorted by key, cell ids follow the (y, x) order like the dense grid.
+    // Only the cells are sorted, there are several particles per cell
+    int blocks = std::max(1, std::min(int(pool->size()), int(capacity / 16384)));
+    size_t block_size = (capacity + blocks - 1) / blocks;
+    block_sums.resize(blocks + 1);
+    pool->syncChunks(blocks, [&](int b) {
+        int n = 0;
+        size_t end = std::min(capacity, (b + 1) * block_size);
+        for (size_t slot = b * block_size; slot < end; slot++) {
+            n += slot_keys[slot] != ~0ull;
+        }
+        block_sums[b + 1] = n;
+    });
+    block_sums[0] = 0;
+    for (int b = 0; b < blocks; b++) {
+        block_sums[b + 1] += block_sums[b];
+    }
+    int cells = block_sums[blocks];
+    keys.resize(cells);
+    pool->syncChunks(blocks, [&](int b) {
+        int next = block_sums[b];
+        size_t end = std::min(capacity, (b + 1) * block_size);
+        for (size_t slot = b * block_size; slot < end; slot++) {
+            if (slot_keys[slot] != ~0ull) {
+                keys[next++] = {slot_keys[slot], int(slot)};
+            }
+        }
+    });
+    std::sort(keys.begin(), keys.end());
+
+    // 3. the set becomes the lookup table, slot to cell id
+    table.resize(capacity);
+    occupied_cells.resize(cells);
+    pool->parallel_for(0, int(capacity), 16384, [&](int first, int last) {
+        for (int slot = first; slot < last; slot++) {
+            table[slot] = -1;
+        }
+    });
+    pool->parallel_for(0, cells, 4096, [&](int first, int last) {
+        for (int c = first; c < last; c++) {
+            unsigned long long k = keys[c].first;
+            auto cx = int(static_cast<unsigned int>(k) ^ 0x80000000u);
+            auto cy = int(static_cast<unsigned int>(k >> 32) ^ 0x80000000u);
+            occupied_cells[c] = Cell{cx, cy, c};
+            table[keys[c].second] = c;
+        }
+    });
+
+    // 4. counting sort by cell id as in the dense grid
+    chunks = std::max(1, std::min(chunks, int(max_histogram_size / std::max(cells, 1))));
+    chunk_size = (count + chunks - 1) / chunks;
+    chunk_counts.resize(size_t(chunks) * cells);
+    cell_start.resize(cells + 1);
+    pool->syncChunks(chunks, [&](int t) {
+        int *histogram = chunk_counts.data() + size_t(t) * cells;
+        std::fill(histogram, histogram + cells, 0);
+        int end = std::min(count, (t + 1) * chunk_size);
+        for (int i = t * chunk_size; i < end; i++) {
+            if (particle_cell[i] >= 0) {
+                int cell = table[particle_cell[i]];
+                particle_cell[i] = cell;
+                histogram[cell]++;
+            }
+        }
+    });
+    scatter_by_cell(count, cells, chunks, chunk_size, pool);
+}
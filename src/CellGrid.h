@@ -0,0 +1,220 @@
+//
+// Created by ZhangHao on 2022/12/8.
+//
+
+#ifndef CFD_2D_CELL_GRID_H
+#define CFD_2D_CELL_GRID_H
+
+#include "ThreadPool.h"
+#include <vector>
+
+// uniform grid of cell size h, particles are indexed with a counting sort:
+// cell c holds sorted[cell_start[c]] ... sorted[cell_start[c + 1] - 1]
+// in ascending particle order.
+// The dense backend stores every cell of a cols x rows box and drops particles
+// outside of it. The hashed backend stores occupied cells only, found through a
+// hash table, and has no extent. Cell ids follow the (y, x) order of the cells in both
+class CellGrid {
+public:
+    // particle indices of one cell
+    struct Range {
+        const int *first;
+        const int *last;
+
+        const int *begin() const { return first; }
+
+        const int *end() const { return last; }
+
+        size_t size() const { return last - first; }
+
+        bool empty() const { return first == last; }
+    };
+
+    // a non-empty cell
+    struct Cell {
+        int x;
+        int y;
+        int id;
+    };
+
+    // dense backend, cols x rows cells, cell (0, 0) starts at (left, bottom)
+    void resize(int cols, int rows, float left, float bottom, float h);
+
+    // hashed backend, cell (0, 0) starts at (left, bottom)
+    void resizeHashed(float left, float bottom, float h);
+
+    // index positions x, y of count particles, particles outside are dropped
+    void build(const float *x, const float *y, int count, nano_std::ThreadPool *pool);
+
+    // particle i is now particle order[i], the cells stay. The order must keep the
+    // particles of a cell in their sorted order, as if built again
+    void renumber(const int *order, int count, nano_std::ThreadPool *pool);
+
+    bool isHashed() const {
+        return hashed;
+    }
+
+    // extent of the dense backend, 0 for the hashed one
+    int columns() const {
+        return grid_col;
+    }
+
+    int rows() const {
+        return grid_raw;
+    }
+
+    // cells with particles, in id order
+    const std::vector<Cell> &occupied() const {
+        return occupied_cells;
+    }
+
+    // upper bound of the cell ids, for arrays indexed by cell id
+    int cellIds() const {
+        return int(cell_start.size()) - 1;
+    }
+
+    inline bool inGrid(int x, int y) const {
+        return hashed || (x < grid_col && x >= 0 && y < grid_raw && y >= 0);
+    }
+
+    // particles of a cell id
+    inline Range cellRange(int c) const {
+        return Range{sorted.data() + cell_start[c], sorted.data() + cell_start[c + 1]};
+    }
+
+    inline Range cellAt(int x, int y) const {
+        if (hashed) {
+            int c = find(x, y);
+            if (c < 0) {
+                return Range{sorted.data(), sorted.data()};
+            }
+            return cellRange(c);
+        }
+        return cellRange(y * grid_col + x);
+    }
+
+    // call visit(range) for the cells of the 3 x 3 block centered at cell (x, y),
+    // column by column, cells outside the grid are skipped.
+    // reach > 1 widens the block to (2 * reach + 1) x (2 * reach + 1)
+    template<typename Visitor>
+    inline void forEachNeighbourRange(int x, int y, Visitor &&visit, int reach = 1) const {
+        for (int k = -reach; k <= reach; k++) {
+            for (int d = -reach; d <= reach; d++) {
+                if (inGrid(x + k, y + d)) {
+                    visit(cellAt(x + k, y + d));
+                }
+            }
+        }
+    }
+
+    // call visit(particle) for all particles in the 3 x 3 block centered at cell (x, y)
+    template<typename Visitor>
+    inline void forEachNeighbour(int x, int y, Visitor &&visit, int reach = 1) const {
+        forEachNeighbourRange(x, y, [&visit](Range range) {
+            for (int other: range) {
+                visit(other);
+            }
+        }, reach);
+    }
+
+    // half stencil: call visit(other) once for every pair (particle, other) with
+    // other after particle in cell order, (cell, index) compared lexicographically.
+    // Those are the later particles of the own cell and the cells
+    // (x + 1, y), (x - 1, y + 1), (x, y + 1), (x + 1, y + 1)
+    template<typename Visitor>
+    inline void forEachForwardNeighbour(int particle, int x, int y, Visitor &&visit) const {
+        Range own = cellAt(x, y);
+        const int *self = own.begin();
+        while (self != own.end() && *self != particle) {
+            self++;
+        }
+        for (const int *other = self + 1; other < own.end(); other++) {
+            visit(*other);
+        }
+        const int forward[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+        for (auto &offset : forward) {
+            if (inGrid(x + offset[0], y + offset[1])) {
+                for (int other: cellAt(x + offset[0], y + offset[1])) {
+                    visit(other);
+                }
+            }
+        }
+    }
+
+    // cell id of a particle, -1 if it is outside the grid
+    inline int cellOf(int particle) const {
+        return particle_cell[particle];
+    }
+
+    // coordinates of a cell id
+    inline void cellCoords(int c, int &x, int &y) const {
+        if (hashed) {
+            x = occupied_cells[c].x;
+            y = occupied_cells[c].y;
+        } else {
+            x = c % grid_col;
+            y = c / grid_col;
+        }
+    }
+
+private:
+    bool hashed{false};
+    int grid_col{0};
+    int grid_raw{0};
+    float left{0};
+    float bottom{0};
+    float h{1};
+
+    // sort key of a cell, (y, x) order
+    static inline unsigned long long key(int x, int y) {
+        return (static_cast<unsigned long long>(static_cast<unsigned int>(y) ^ 0x80000000u) << 32) |
+               (static_cast<unsigned int>(x) ^ 0x80000000u);
+    }
+
+    static inline size_t hash(unsigned long long k) {
+        k ^= k >> 29;
+        k *= 0xbf58476d1ce4e5b9ull;
+        return size_t(k ^ (k >> 32));
+    }
+
+    // id of the hashed cell (x, y), -1 if it is empty
+    inline int find(int x, int y) const {
+        size_t mask = table.size() - 1;
+        for (size_t slot = hash(key(x, y)) & mask;; slot = (slot + 1) & mask) {
+            int c = table[slot];
+            if (c < 0 || (occupied_cells[c].x == x && occupied_cells[c].y == y)) {
+                return c;
+            }
+        }
+    }
+
+    void build_dense(const float *x, const float *y, int count, nano_std::ThreadPool *pool);
+
+    void build_hashed(const float *x, const float *y, int count, nano_std::ThreadPool *pool);
+
+    // prefix sum of the chunk histograms into cell_start and the chunk offsets, then
+    // write the particles of particle_cell into sorted, stable inside each cell
+    void scatter_by_cell(int count, int cells, int chunks, int chunk_size, nano_std::ThreadPool *pool);
+
+    // prefix sum of particle counts, size cells + 1
+    std::vector<int> cell_start;
+    // particle indices sorted by cell
+    std::vector<int> sorted;
+    // cell of each particle
+    std::vector<int> particle_cell;
+    // per chunk histograms, later the per chunk write offsets
+    std::vector<int> chunk_counts;
+    // prefix sum of particle counts in blocks of cells
+    std::vector<int> block_sums;
+    // renumber: old cell of each particle, then the new index of each old one
+    std::vector<int> renumbered;
+    // non-empty cells
+    std::vector<Cell> occupied_cells;
+    // hashed backend: cell keys by hash slot, ~0 when free, (key, slot) of the occupied
+    // slots sorted by key, and the cell id of every slot
+    std::vector<unsigned long long> slot_keys;
+    std::vector<std::pair<unsigned long long, int>> keys;
+    std::vector<int> table;
+};
+
+#endif //CFD_2D_CELL_GRID_H
@@ -0,0 +1,292 @@
+//
+// Created by ZhangHao on 2022/12/15.
+//
+
+#include "Checkpoint.h"
+#include "LineBoundary.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<Checkpoint::Header>::value, "the header is stored as is");
+
+static const char magic[8] = {'C', 'F', 'D', '2', 'D', 'C', 'K', 'P'};
+// particle arrays in the file, x y vx vy ax ay rho p inv_rho, then ids and the list positions
+static const int float_arrays = 9;
+
+static uint64_t array_count(const Checkpoint::Header &header) {
+    return float_arrays + (header.has_ids ? 1 : 0) + (header.has_lists ? 2 : 0);
+}
+
+static uint64_t align_64(uint64_t offset) {
+    return (offset + 63) / 64 * 64;
+}
+
+static Checkpoint::KernelId kernel_id(const SmoothKernels::SmoothKernel<D2> *kernel) {
+    Checkpoint::KernelId id{Checkpoint::no_kernel, 0, 0, 0};
+    if (kernel != nullptr) {
+        id.kind = uint32_t(kernel->kind());
+        if (const SmoothKernels::KernelTable<D2> *table = kernel->tabulation()) {
+            id.table_kind = uint32_t(table->sampledKind());
+            id.table_resolution = uint32_t(table->resolution());
+            id.table_h = table->h();
+        }
+    }
+    return id;
+}
+
+static void kernel_ids(const Fluid2D::Fluid2DParameters &p, Checkpoint::KernelId ids[4]) {
+    ids[0] = kernel_id(p.rho_kernel);
+    ids[1] = kernel_id(p.pressure_kernel);
+    ids[2] = kernel_id(p.viscosity_kernel);
+    ids[3] = kernel_id(p.surface_tension_kernel);
+}
+
+// count items of item_size bytes from offset stay within limit, without wrapping around
+static bool fits(uint64_t offset, uint64_t count, uint64_t item_size, uint64_t limit) {
+    return offset <= limit && (item_size == 0 || count <= (limit - offset) / item_size);
+}
+
+// every id below count, and each once
+static bool is_permutation(const unsigned int *ids, uint32_t count) {
+    std::vector<bool> seen(count, false);
+    for (uint32_t i = 0; i < count; i++) {
+        if (ids[i] >= count || seen[ids[i]]) {
+            return false;
+        }
+        seen[ids[i]] = true;
+    }
+    return true;
+}
+
+static Checkpoint::Params save_params(const Fluid2D::Fluid2DParameters &p) {
+    Checkpoint::Params out{};
+    vec2 gravity = p.gravity;
+    out.delta_t = p.delta_t;
+    out.top = p.top;
+    out.bottom = p.bottom;
+    out.left = p.left;
+    out.right = p.right;
+    out.h = p.h;
+    out.gravity_x = gravity.x();
+    out.gravity_y = gravity.y();
+    out.particle_mass = p.particle_mass;
+    out.rho_0 = p.rho_0;
+    out.K = p.K;
+    out.V = p.V;
+    out.sigma = p.sigma;
+    out.verlet_skin = p.verlet_skin;
+    out.dt_min = p.dt_min;
+    out.dt_max = p.dt_max;
+    out.cfl_factor = p.cfl_factor;
+    out.force_factor = p.force_factor;
+    out.viscosity_factor = p.viscosity_factor;
+    out.reorder_interval = p.reorder_interval;
+    out.tile_size = p.tile_size;
+    out.kernel_isa = uint32_t(p.kernel_isa);
+    out.flags = (p.hashed_grid ? Checkpoint::HASHED_GRID : 0) |
+                (p.clamp_to_domain ? Checkpoint::CLAMP_TO_DOMAIN : 0) |
+                (p.vectorize ? Checkpoint::VECTORIZE : 0) |
+                (p.symmetric_pairs ? Checkpoint::SYMMETRIC_PAIRS : 0) |
+                (p.fused_eos ? Checkpoint::FUSED_EOS : 0) |
+                (p.adaptive_dt ? Checkpoint::ADAPTIVE_DT : 0);
+    return out;
+}
+
+static void load_params(const Checkpoint::Params &in, Fluid2D::Fluid2DParameters &p) {
+    p.delta_t = in.delta_t;
+    p.top = in.top;
+    p.bottom = in.bottom;
+    p.left = in.left;
+    p.right = in.right;
+    p.h = in.h;
+    p.gravity = vec2(in.gravity_x, in.gravity_y);
+    p.particle_mass = in.particle_mass;
+    p.rho_0 = in.rho_0;
+    p.K = in.K;
+    p.V = in.V;
+    p.sigma = in.sigma;
+    p.verlet_skin = in.verlet_skin;
+    p.dt_min = in.dt_min;
+    p.dt_max = in.dt_max;
+    p.cfl_factor = in.cfl_factor;
+    p.force_factor = in.force_factor;
+    p.viscosity_factor = in.viscosity_factor;
+    p.reorder_interval = in.reorder_interval;
+    p.tile_size = in.tile_size;
+    p.kernel_isa = SimdKernels::ISA(in.kernel_isa);
+    p.hashed_grid = (in.flags & Checkpoint::HASHED_GRID) != 0;
+    p.clamp_to_domain = (in.flags & Checkpoint::CLAMP_TO_DOMAIN) != 0;
+    p.vectorize = (in.flags & Checkpoint::VECTORIZE) != 0;
+    p.symmetric_pairs = (in.flags & Checkpoint::SYMMETRIC_PAIRS) != 0;
+    p.fused_eos = (in.flags & Checkpoint::FUSED_EOS) != 0;
+    p.adaptive_dt = (in.flags & Checkpoint::ADAPTIVE_DT) != 0;
+}
+
+bool Checkpoint::saveAsync(const Fluid2D &fluid, const std::string &path) {
+    if (!wait()) {
+        return false;
+    }
+    std::vector<Wall> walls;
+    for (auto &boundary : fluid.allBoundaries()) {
+        auto *line = dynamic_cast<const LineBoundary *>(boundary.get());
+        if (line == nullptr) {
+            last_error = "only line boundaries can be saved";
+            return false;
+        }
+        walls.push_back(Wall{line->uniformStart().x(), line->uniformStart().y(),
+                             line->uniformEnd().x(), line->uniformEnd().y(), line->damping()});
+    }
+    Fluid2D::State state = fluid.state();
+    const Fluid2D::Fluid2DParameters &params = fluid.params;
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.header_size = sizeof(Header);
+    header.particle_count = state.count;
+    header.boundary_count = uint32_t(walls.size());
+    header.has_ids = state.ids != nullptr;
+    header.has_lists = state.list_x != nullptr && state.list_y != nullptr;
+    kernel_ids(params, header.kernels);
+    header.step = state.step;
+    header.reorders = state.reorders;
+    header.simulated_time = state.simulated_time;
+    header.last_dt = state.last_dt;
+    header.params = save_params(params);
+    header.walls_offset = align_64(sizeof(Header));
+    header.arrays_offset = align_64(header.walls_offset + walls.size() * sizeof(Wall));
+    header.array_stride = align_64(uint64_t(state.count) * sizeof(float));
+    header.file_size = header.arrays_offset + header.array_stride * array_count(header);
+
+    // the copy is all the solver waits for, the file is written on io
+    buffer.assign(header.file_size, 0);
+    std::memcpy(buffer.data(), &header, sizeof(Header));
+    if (!walls.empty()) {
+        std::memcpy(buffer.data() + header.walls_offset, walls.data(), walls.size() * sizeof(Wall));
+    }
+    const float *arrays[float_arrays] = {state.x, state.y, state.vx, state.vy, state.ax, state.ay,
+                                         state.rho, state.p, state.inv_rho};
+    for (int k = 0; k < float_arrays; k++) {
+        std::memcpy(buffer.data() + header.arrays_offset + k * header.array_stride, arrays[k],
+                    state.count * sizeof(float));
+    }
+    int next = float_arrays;
+    if (header.has_ids) {
+        std::memcpy(buffer.data() + header.arrays_offset + next++ * header.array_stride, state.ids,
+                    state.count * sizeof(unsigned int));
+    }
+    if (header.has_lists) {
+        for (const float *list : {state.list_x, state.list_y}) {
+            std::memcpy(buffer.data() + header.arrays_offset + next++ * header.array_stride, list,
+                        state.count * sizeof(float));
+        }
+    }
+    target = path;
+    io = std::thread([this]() {
+        write_file();
+    });
+    return true;
+}
+
+void Checkpoint::write_file() {
+    std::string temp = target + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(buffer.data(), std::streamsize(buffer.size()));
+        out.flush();
+        write_ok = bool(out);
+    }
+    std::error_code ec;
+    if (write_ok) {
+        std::filesystem::rename(temp, target, ec);
+        write_ok = !ec;
+    }
+    if (!write_ok) {
+        std::filesystem::remove(temp, ec);
+    }
+}
+
+bool Checkpoint::wait() {
+    if (io.joinable()) {
+        io.join();
+        if (!write_ok) {
+            last_error = "could not write " + target;
+            write_ok = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Checkpoint::load(Fluid2D &fluid, const std::string &path) {
+    // arrays are read straight from the mapping, pages are only touched once
+    nano_std::MappedFile file;
+    if (!file.open(path)) {
+        last_error = "could not open " + path;
+        return false;
+    }
+    const char *data = file.data();
+    size_t size = file.size();
+
+    Header header{};
+    if (size < sizeof(Header)) {
+        last_error = path + " is not a checkpoint";
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(Header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        last_error = path + " is not a checkpoint";
+        return false;
+    }
+    if (header.version != version || header.header_size != sizeof(Header)) {
+        last_error = path + " has checkpoint version " + std::to_string(header.version) +
+                     ", expected " + std::to_string(version);
+        return false;
+    }
+    // offsets and counts come from the file, every sum and product is checked against its size first
+    if (header.file_size != size || header.arrays_offset > size ||
+        !fits(header.walls_offset, header.boundary_count, sizeof(Wall), header.arrays_offset) ||
+        !fits(header.arrays_offset, array_count(header), header.array_stride, size) ||
+        header.array_stride < uint64_t(header.particle_count) * sizeof(float) ||
+        header.arrays_offset % 64 != 0 || header.array_stride % 64 != 0) {
+        last_error = path + " is truncated or damaged";
+        return false;
+    }
+    KernelId kernels[4];
+    kernel_ids(fluid.params, kernels);
+    if (std::memcmp(kernels, header.kernels, sizeof(kernels)) != 0) {
+        last_error = path + " was saved with other kernels";
+        return false;
+    }
+    const char *ids = data + header.arrays_offset + float_arrays * header.array_stride;
+    if (header.has_ids && !is_permutation(reinterpret_cast<const unsigned int *>(ids), header.particle_count)) {
+        last_error = path + " has damaged particle ids";
+        return false;
+    }
+
+    load_params(header.params, fluid.params);
+    fluid.clearBoundaries();
+    for (uint32_t i = 0; i < header.boundary_count; i++) {
+        Wall wall{};
+        std::memcpy(&wall, data + header.walls_offset + i * sizeof(Wall), sizeof(Wall));
+        fluid.addBoundary(std::make_shared<LineBoundary>(wall.start_x, wall.start_y,
+                                                         wall.end_x, wall.end_y, wall.damp));
+    }
+    // the arrays are read in place, the solver copies them into its own storage
+    auto array = [&](int k) {
+        return reinterpret_cast<const float *>(data + header.arrays_offset + k * header.array_stride);
+    };
+    int lists = float_arrays + (header.has_ids ? 1 : 0);
+    Fluid2D::State state{header.particle_count, header.step, header.reorders,
+                         header.simulated_time, header.last_dt,
+                         array(0), array(1), array(2), array(3), array(4), array(5),
+                         array(6), array(7), array(8),
+                         header.has_ids ? reinterpret_cast<const unsigned int *>(array(float_arrays)) : nullptr,
+                         header.has_lists ? array(lists) : nullptr,
+                         header.has_lists ? array(lists + 1) : nullptr};
+    fluid.restore(state);
+    return true;
+}
@@ -0,0 +1,138 @@
+//
+// Created by ZhangHao on 2022/12/15.
+//
+
+#ifndef CFD_2D_CHECKPOINT_H
+#define CFD_2D_CHECKPOINT_H
+
+#include "Fluid2D.h"
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// binary snapshot of a run, enough to continue it without re-running the steps before.
+// File layout, native byte order:
+//   Header, with the parameters that change results and the kernels
+//   boundary_count Wall records, line boundaries in the uniform CS
+//   the particle arrays x y vx vy ax ay rho p inv_rho, then ids when the particles were
+//   reordered, then the positions of the last Verlet list build when there are lists.
+//   Every array starts on 64 bytes
+// Files are written to path.tmp and renamed over path, so a crash while writing
+// leaves the previous checkpoint in place. A restored run continues bit for bit
+class Checkpoint {
+public:
+    static constexpr uint32_t version = 2;
+
+    // the parameters saved in a checkpoint, execution settings like the worker count are not
+    struct Params {
+        float delta_t;
+        float top, bottom, left, right;
+        float h;
+        float gravity_x, gravity_y;
+        float particle_mass;
+        float rho_0, K, V, sigma;
+        float verlet_skin;
+        float dt_min, dt_max, cfl_factor, force_factor, viscosity_factor;
+        uint32_t reorder_interval;
+        uint32_t tile_size;
+        uint32_t kernel_isa;
+        // bits of the flags below
+        uint32_t flags;
+    };
+
+    enum ParamFlags {
+        HASHED_GRID = 1,
+        CLAMP_TO_DOMAIN = 2,
+        VECTORIZE = 4,
+        SYMMETRIC_PAIRS = 8,
+        FUSED_EOS = 16,
+        ADAPTIVE_DT = 32
+    };
+
+    // which kernel a term used. kind is the SmoothKernels::KernelKind, no_kernel when unset.
+    // Tabulated kernels (kind CUSTOM) add the kind, h and resolution of their table
+    struct KernelId {
+        uint32_t kind;
+        uint32_t table_kind;
+        uint32_t table_resolution;
+        float table_h;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t particle_count;
+        uint32_t boundary_count;
+        // 1 if the ids array is stored, 1 if the list_x and list_y arrays are
+        uint32_t has_ids;
+        uint32_t has_lists;
+        // rho, pressure, viscosity and surface tension kernels
+        KernelId kernels[4];
+        uint64_t step;
+        uint64_t reorders;
+        double simulated_time;
+        float last_dt;
+        Params params;
+        // byte offsets in the file, and the distance between two particle arrays
+        uint64_t walls_offset;
+        uint64_t arrays_offset;
+        uint64_t array_stride;
+        uint64_t file_size;
+    };
+
+    struct Wall {
+        float start_x, start_y;
+        float end_x, end_y;
+        float damp;
+    };
+
+    static constexpr uint32_t no_kernel = 0xffffffffu;
+
+    Checkpoint() = default;
+
+    Checkpoint(const Checkpoint &) = delete;
+
+    Checkpoint &operator=(const Checkpoint &) = delete;
+
+    ~Checkpoint() {
+        wait();
+    }
+
+    // copy the state of fluid and write it to path on a background thread, the solver may
+    // go on as soon as this returns. Waits for the previous write first.
+    // Only while the solver is not running, boundaries must be LineBoundary
+    bool saveAsync(const Fluid2D &fluid, const std::string &path);
+
+    // wait for the write in flight, false if it failed
+    bool wait();
+
+    // map path and continue fluid from it: parameters, boundaries and particles.
+    // The kernels of fluid stay, they must be the kernels saved in the file, tables with
+    // the same resolution. Particle ids must be a permutation of the particles.
+    // Only while the solver is not running
+    bool load(Fluid2D &fluid, const std::string &path);
+
+    // why the last save, write or load failed
+    const std::string &error() const {
+        return last_error;
+    }
+
+    // size of the last checkpoint saved
+    size_t bytes() const {
+        return buffer.size();
+    }
+
+private:
+    // the file image of the last save, written by io
+    std::vector<char> buffer;
+    std::string target;
+    std::thread io;
+    bool write_ok{true};
+    std::string last_error;
+
+    void write_file();
+};
+
+#endif //CFD_2D_CHECKPOINT_H
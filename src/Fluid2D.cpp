@@ -1,7 +1,13 @@
 #include "Fluid2D.h"
-#include "GLHeaders.h"
+#include "KernelPolicies.h"
+#include <algorithm>
 #include <future>
 #include <limits>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
 
 struct TicTok {
     const char *label;
@@ -18,54 +24,206 @@ struct TicTok {
     }
 };
 
+// worker_count and pin_workers, after the environment overrides
+static void pool_settings(const Fluid2D::Fluid2DParameters &params, unsigned int &count, bool &pin) {
+    count = params.worker_count;
+    pin = params.pin_workers;
+    if (const char *threads = std::getenv("CFD_2D_THREADS")) {
+        long n = std::strtol(threads, nullptr, 10);
+        if (n > 0) {
+            count = (unsigned int) n;
+        }
+    }
+    if (const char *pinned = std::getenv("CFD_2D_PIN")) {
+        pin = std::strcmp(pinned, "0") != 0;
+    }
+    if (count == 0) {
+        count = (unsigned int) nano_std::ThreadPool::availableCpus().size();
+    }
+}
+
 Fluid2D::Fluid2D(Fluid2DParameters &params) {
     this->params = params;
-    this->scale = 1;
-    pool = new nano_std::ThreadPool(20);
+    this->is_running = false;
+    pool_settings(params, this->params.worker_count, this->params.pin_workers);
+    pool = new nano_std::ThreadPool(this->params.serial ? 0 : this->params.worker_count,
+                                    params.lock_free_queue ? nano_std::ThreadPool::LOCK_FREE
+                                                           : nano_std::ThreadPool::LOCKED,
+                                    this->params.pin_workers);
+    // room for the neighbours of dense regions, lists only grow past it in extreme cases
+    workspace.neighbours.resize(pool->size() + 1);
+    for (auto &list : workspace.neighbours) {
+        list.reserve(1024);
+    }
+    // nobody reads the frames yet, size all of them so drifting into them never allocates
+    unsigned int count = params.particle_count;
+    snapshots.forEachSlot([count](PositionFrame &frame) {
+        frame.x.resize(count);
+        frame.y.resize(count);
+        frame.ids.resize(count);
+    });
     init();
 }
 
 void Fluid2D::init() {
     // alloc memory
-    positions.resize(params.particle_count);
-    back_positions.resize(params.particle_count);
-    velocities.clear();
-    acc_s.clear();
-    acc_s.resize(params.particle_count);
-    velocities.resize(params.particle_count);
-    grid_raw = int(std::floor((params.top - params.bottom) / params.h)) + 1;
-    grid_col = int(std::floor((params.right - params.left) / params.h)) + 1;
-    grid.resize(grid_raw * grid_col);
+    std::vector<vec2 > positions(params.particle_count);
+    for (unsigned int i = 0; i < particles.size(); i++) {
+        unsigned int id = reordered ? particle_ids[i] : i;
+        if (id < params.particle_count) {
+            positions[id] = particles.position(i);
+        }
+    }
+    reordered = false;
+    ids_version++;
+    resize_storage();
 
     // init positions
     if (params.init_positions != nullptr) {
         params.init_positions(positions, params.top, params.bottom, params.left, params.right);
-        back_positions = positions;
     }
+    next_positions();
+    for (unsigned int i = 0; i < params.particle_count; i++) {
+        particles.x[i] = positions[i].x();
+        particles.y[i] = positions[i].y();
+    }
+    verlet.invalidate();
+    boundary_index_dirty = true;
+    needs_acceleration = true;
+    last_dt = params.delta_t;
+    simulated_time = 0;
+    step_count = 0;
+    publish_positions();
+}
+
+void Fluid2D::resize_storage() {
+    particles.resize(params.particle_count);
+    workspace.half_vx.resize(params.particle_count);
+    workspace.half_vy.resize(params.particle_count);
+    particle_ids.resize(params.particle_count);
+    if (params.hashed_grid) {
+        grid.resizeHashed(params.left - params.h / 2, params.bottom - params.h / 2, params.h);
+    } else {
+        int grid_raw = int(std::floor((params.top - params.bottom) / params.h)) + 1;
+        int grid_col = int(std::floor((params.right - params.left) / params.h)) + 1;
+        grid.resize(grid_col, grid_raw, params.left - params.h / 2, params.bottom - params.h / 2, params.h);
+    }
+    // occupied cells are bounded by the dense grid, or by the particles of a hashed one
+    tile_graph.reserve(params.hashed_grid ? int(params.particle_count) : grid.cellIds());
 }
 
-void Fluid2D::update() {
-    render();
+Fluid2D::State Fluid2D::state() const {
+    return State{params.particle_count, step_count, reorder_count, simulated_time, last_dt,
+                 particles.x, particles.y, particles.vx.data(), particles.vy.data(),
+                 particles.ax.data(), particles.ay.data(),
+                 particles.rho.data(), particles.p.data(), particles.inv_rho.data(),
+                 reordered ? particle_ids.data() : nullptr,
+                 params.verlet_skin > 0 ? verlet.builtX() : nullptr,
+                 params.verlet_skin > 0 ? verlet.builtY() : nullptr};
+}
+
+void Fluid2D::restore(const State &state) {
+    params.particle_count = state.count;
+    resize_storage();
+    size_t count = state.count;
+    reordered = state.ids != nullptr;
+    if (reordered) {
+        std::copy(state.ids, state.ids + count, particle_ids.begin());
+    }
+    ids_version++;
+    next_positions();
+    std::copy(state.x, state.x + count, particles.x);
+    std::copy(state.y, state.y + count, particles.y);
+    std::copy(state.vx, state.vx + count, particles.vx.begin());
+    std::copy(state.vy, state.vy + count, particles.vy.begin());
+    std::copy(state.ax, state.ax + count, particles.ax.begin());
+    std::copy(state.ay, state.ay + count, particles.ay.begin());
+    std::copy(state.rho, state.rho + count, particles.rho.begin());
+    std::copy(state.p, state.p + count, particles.p.begin());
+    std::copy(state.inv_rho, state.inv_rho + count, particles.inv_rho.begin());
+    // accelerations come with the state, lists and indices are built again
+    if (params.verlet_skin > 0 && state.list_x != nullptr && state.list_y != nullptr) {
+        grid.build(state.list_x, state.list_y, int(count), pool);
+        verlet.build(grid, state.list_x, state.list_y, int(count), params.h, params.verlet_skin,
+                     params.symmetric_pairs, pool);
+    } else {
+        verlet.invalidate();
+    }
+    boundary_index_dirty = true;
+    needs_acceleration = false;
+    last_dt = state.last_dt;
+    simulated_time = state.simulated_time;
+    step_count = state.step;
+    reorder_count = state.reorders;
+    publish_positions();
+}
+
+void Fluid2D::next_positions() {
+    PositionFrame &frame = snapshots.back();
+    frame.x.resize(params.particle_count);
+    frame.y.resize(params.particle_count);
+    particles.x = frame.x.data();
+    particles.y = frame.y.data();
+}
+
+void Fluid2D::publish_positions() {
+    // the solver keeps reading the frame, consumers only read it too
+    PositionFrame &frame = snapshots.back();
+    frame.step = step_count;
+    if (frame.ids_version != ids_version) {
+        // ids changed since the frame was last published, sized with the frame
+        frame.reordered = reordered;
+        if (reordered) {
+            frame.ids.assign(particle_ids.begin(), particle_ids.end());
+        }
+        frame.ids_version = ids_version;
+    }
+    snapshots.publish();
 }
 
 void Fluid2D::start() {
     // main dispatch task
     this->is_running = true;
     // initial acceleration
-    acc_s.clear();
-    acc_s.resize(params.particle_count);
-    acceleration(positions, velocities, acc_s);
+    initial_acceleration();
     std::function<void()> task = [this]() {
         while (this->is_running) {
             TicTok t("one step duration");
             this->step();
-            std::unique_lock<std::mutex> lk(this->swap_mutex);
-            this->back_positions = this->positions;
         }
     };
     dispatcher.run(task);
 }
 
+void Fluid2D::advance(unsigned int steps) {
+    if (is_running) {
+        return;
+    }
+    // force tasks are skipped once the solver stops, keep it marked running
+    is_running = true;
+    initial_acceleration();
+    for (unsigned int i = 0; i < steps && is_running; i++) {
+        step();
+    }
+    is_running = false;
+}
+
+unsigned int Fluid2D::advanceTime(double seconds) {
+    if (is_running) {
+        return 0;
+    }
+    is_running = true;
+    initial_acceleration();
+    double end = simulated_time + seconds;
+    unsigned int steps = 0;
+    while (simulated_time < end && is_running) {
+        step();
+        steps++;
+    }
+    is_running = false;
+    return steps;
+}
+
 void Fluid2D::resetWithCallback(std::function<void()> callback) {
     stop();
     std::this_thread::sleep_for(std::chrono::milliseconds (100));
@@ -76,260 +234,848 @@ void Fluid2D::resetWithCallback(std::function<void()> callback) {
         for (auto &boundary:boundaries) {
             boundary->updateCS(params.top, params.bottom, params.right , params.left);
         }
+        boundary_index_dirty = true;
     });
 }
 
+void Fluid2D::initial_acceleration() {
+    if (!needs_acceleration) {
+        return;
+    }
+    needs_acceleration = false;
+    update_boundary_index();
+    if (params.verlet_skin > 0) {
+        update_neighbour_lists();
+    } else {
+        index_all_particles();
+    }
+    acceleration(particles.vx.data(), particles.vy.data());
+}
+
 void Fluid2D::step() {
-    index_all_particles();
+    bool use_verlet = params.verlet_skin > 0;
+    update_boundary_index();
+    // a reorder leaves the grid indexed for the new order
+    bool reorder = params.reorder_interval > 0 && step_count % params.reorder_interval == 0;
+    if (reorder) {
+        reorder_particles();
+    }
+    if (!use_verlet && !reorder) {
+        index_all_particles();
+    }
     // leap frogs
-    std::vector<vec2 > velocity_half(params.particle_count);
-    float half_dt = params.delta_t / 2;
-    for (int i = 0; i < params.particle_count; i++) {
-        vec2 dv = acc_s[i] * half_dt;
-        velocity_half[i] = velocities[i] + dv;
-        vec2 dp = velocity_half[i] * params.delta_t;
-        // update position and boundary check
-        vec2 next_position = positions[i] + dp;
-        // boundaries check
-        bool should_update_pos = true;
-        for (auto &boundary:boundaries) {
-            if (boundary->updateAt(i, next_position, positions, velocity_half)) {
-                should_update_pos = false;
-            }
+    workspace.half_vx.resize(params.particle_count);
+    workspace.half_vy.resize(params.particle_count);
+    // drift from the published frame into the back frame
+    const float *x = particles.x, *y = particles.y;
+    next_positions();
+    float *next_x = particles.x, *next_y = particles.y;
+    float *vx = particles.vx.data(), *vy = particles.vy.data();
+    float *ax = particles.ax.data(), *ay = particles.ay.data();
+    float *vhx = workspace.half_vx.data(), *vhy = workspace.half_vy.data();
+    float dt = params.adaptive_dt ? time_step() : params.delta_t;
+    float half_dt = dt / 2;
+    last_dt = dt;
+    simulated_time += dt;
+    // half kick, drift and boundary checks, every particle on its own.
+    // Boundaries only read their geometry, update_boundary writes particle i only
+    pool->parallel_for(0, int(params.particle_count), 1024, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            vhx[i] = vx[i] + ax[i] * half_dt;
+            vhy[i] = vy[i] + ay[i] * half_dt;
         }
-        // try to update positions
-        if (should_update_pos) {
-            positions[i] = next_position;
+        for (int i = first; i < last; i++) {
+            // update position and boundary check
+            vec2 position(x[i], y[i]);
+            vec2 next_position(x[i] + vhx[i] * dt, y[i] + vhy[i] * dt);
+            vec2 vel(vhx[i], vhy[i]);
+            // boundaries check
+            bool should_update_pos = true;
+            for (auto &boundary:boundaries) {
+                if (boundary->updateAt(position, next_position, vel)) {
+                    should_update_pos = false;
+                }
+            }
+            vhx[i] = vel.x();
+            vhy[i] = vel.y();
+            // try to update positions
+            if (!should_update_pos) {
+                next_position = position;
+            }
+            next_x[i] = next_position.x();
+            next_y[i] = next_position.y();
+            // grid boundary
+            if (params.clamp_to_domain) {
+                update_boundary(i, vhx, vhy);
+            }
         }
-        // grid boundary
-        update_boundary(i, positions, velocity_half);
+    });
+    step_count++;
+    publish_positions();
+    // the lists are checked against the positions they are used with
+    if (use_verlet) {
+        update_neighbour_lists();
     }
     // update velocities
-    std::vector<vec2 > next_acc(params.particle_count);
-    acceleration(positions, velocity_half, next_acc);
-    for (int i = 0; i < params.particle_count; i++) {
-        vec2 dv = next_acc[i] * half_dt;
-        velocities[i] = velocity_half[i] + dv;
+    acceleration(vhx, vhy);
+    if (!is_running) {
+        // forces were skipped, compute them again before the next run
+        needs_acceleration = true;
+    }
+    pool->parallel_for(0, int(params.particle_count), 4096, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            vx[i] = vhx[i] + ax[i] * half_dt;
+            vy[i] = vhy[i] + ay[i] * half_dt;
+        }
+    });
+    if (step_callback) {
+        step_callback(*this);
+    }
+}
+
+float Fluid2D::time_step() {
+    // max |v|^2 and |a|^2
+    const float *vx = particles.vx.data(), *vy = particles.vy.data();
+    const float *ax = particles.ax.data(), *ay = particles.ay.data();
+    std::pair<float, float> max_v2_a2 = pool->parallel_reduce(
+            0, int(params.particle_count), 4096, std::make_pair(0.f, 0.f),
+            [&](int first, int last) {
+                float v2 = 0, a2 = 0;
+                for (int i = first; i < last; i++) {
+                    v2 = std::max(v2, vx[i] * vx[i] + vy[i] * vy[i]);
+                    a2 = std::max(a2, ax[i] * ax[i] + ay[i] * ay[i]);
+                }
+                return std::make_pair(v2, a2);
+            },
+            [](std::pair<float, float> a, std::pair<float, float> b) {
+                return std::make_pair(std::max(a.first, b.first), std::max(a.second, b.second));
+            });
+    float v = std::sqrt(max_v2_a2.first);
+    float a = std::sqrt(max_v2_a2.second);
+
+    float dt = params.dt_max;
+    // CFL, no particle moves more than a fraction of h
+    if (v > 0) {
+        dt = std::min(dt, params.cfl_factor * params.h / v);
+    }
+    // forces
+    if (a > 0) {
+        dt = std::min(dt, params.force_factor * std::sqrt(params.h / a));
+    }
+    // viscous diffusion, kinematic viscosity V / rho_0
+    if (params.viscosity_kernel != nullptr && params.V > 0) {
+        dt = std::min(dt, params.viscosity_factor * params.h * params.h * params.rho_0 / params.V);
+    }
+    return std::max(dt, params.dt_min);
+}
+
+void Fluid2D::update_boundary_index() {
+    // pairs are at most one cell apart, or as far as the Verlet lists reach
+    int reach = 1;
+    if (params.verlet_skin > 0) {
+        reach = std::max(1, int(std::ceil((params.h + params.verlet_skin) / params.h)));
+    }
+    if (boundary_index_dirty || boundary_index.reach() != reach) {
+        boundary_index.build(boundaries, params.left - params.h / 2, params.bottom - params.h / 2, params.h, reach);
+        boundary_index_dirty = false;
+        // the surface normal compares cell centres, those tests only change with the boundaries.
+        // The hashed grid has no extent, there the tests run every time
+        int grid_col = grid.columns();
+        centre_blocked.assign(size_t(grid_col) * grid.rows(), 0);
+        for (int i = 0; i < grid.rows(); i++) {
+            for (int j = 0; j < grid_col; j++) {
+                vec2 cell_center(j + 0.5, i + 0.5);
+                for (int k = -1; k < 2; k++) {
+                    for (int d = -1; d < 2; d++) {
+                        vec2 other_center(j + k + 0.5, i + d + 0.5);
+                        if (isSeperatedByBoundaries(cell_center, other_center)) {
+                            centre_blocked[i * grid_col + j] |= 1 << ((d + 1) * 3 + k + 1);
+                        }
+                    }
+                }
+            }
+        }
     }
-    // update acc
-    acc_s = next_acc;
 }
 
 void Fluid2D::index_all_particles() {
     // index all particles into grid;
-    float grid_bottom = params.bottom - params.h / 2;
-    float grid_left = params.left - params.h / 2;
-    for (auto &cell: grid) {
-        cell.clear();
-    }
-    int p_index = 0;
-    for (vec2 &p: positions) {
-        float dy = p.y() - grid_bottom;
-        float dx = p.x() - grid_left;
-        // boundary check
-        if (dx > 0 && dy > 0) {
-            int col_index = ::floor(dx / params.h);
-            int raw_index = ::floor(dy / params.h);
-            // insert into grid;
-            cellAt(col_index, raw_index).push_back(p_index++);
+    grid.build(particles.x, particles.y, params.particle_count, pool);
+}
+
+// interleave the bits of x and y, x in the even bits
+static inline unsigned long long morton_key(unsigned int x, unsigned int y) {
+    auto spread = [](unsigned long long v) {
+        v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+        v = (v | (v << 2)) & 0x3333333333333333ull;
+        v = (v | (v << 1)) & 0x5555555555555555ull;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+void Fluid2D::reorder_particles() {
+    int count = params.particle_count;
+    // the grid sorts particles by cell, only its cells are put in Morton order.
+    // Particles of a cell keep their current order
+    index_all_particles();
+    const std::vector<CellGrid::Cell> &cells = grid.occupied();
+    int cell_count = int(cells.size());
+    std::vector<std::pair<unsigned long long, int>> &cell_keys = workspace.reorder_keys;
+    cell_keys.resize(cell_count);
+    pool->parallel_for(0, cell_count, 4096, [&](int first, int last) {
+        for (int c = first; c < last; c++) {
+            // flip the sign bits so negative cells sort before positive ones
+            unsigned int ux = static_cast<unsigned int>(cells[c].x) ^ 0x80000000u;
+            unsigned int uy = static_cast<unsigned int>(cells[c].y) ^ 0x80000000u;
+            cell_keys[c] = {morton_key(ux, uy), c};
+        }
+    });
+    std::sort(cell_keys.begin(), cell_keys.end());
+
+    // new index of the first particle of each cell, particles outside the grid go last
+    std::vector<int> &start = workspace.reorder_start;
+    std::vector<int> &order = workspace.reorder_order;
+    start.resize(cell_count + 1);
+    order.resize(count);
+    start[0] = 0;
+    for (int k = 0; k < cell_count; k++) {
+        start[k + 1] = start[k] + int(grid.cellRange(cells[cell_keys[k].second].id).size());
+    }
+    pool->parallel_for(0, cell_count, 256, [&](int first, int last) {
+        for (int k = first; k < last; k++) {
+            CellGrid::Range range = grid.cellRange(cells[cell_keys[k].second].id);
+            std::copy(range.begin(), range.end(), order.begin() + start[k]);
+        }
+    });
+    for (int i = 0, next = start[cell_count]; next < count; i++) {
+        if (grid.cellOf(i) < 0) {
+            order[next++] = i;
         }
     }
+
+    // positions go to the back frame, the published one may still be read
+    const float *x = particles.x, *y = particles.y;
+    next_positions();
+    float *next_x = particles.x, *next_y = particles.y;
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            next_x[i] = x[order[i]];
+            next_y[i] = y[order[i]];
+        }
+    });
+    workspace.reorder_scratch.resize(count);
+    for (auto *array : {&particles.vx, &particles.vy, &particles.ax, &particles.ay,
+                        &particles.rho, &particles.p, &particles.inv_rho}) {
+        const float *from = array->data();
+        float *to = workspace.reorder_scratch.data();
+        pool->parallel_for(0, count, 4096, [&](int first, int last) {
+            for (int i = first; i < last; i++) {
+                to[i] = from[order[i]];
+            }
+        });
+        array->swap(workspace.reorder_scratch);
+    }
+    // ids are permuted into the back frame, then kept as the solver's copy
+    PositionFrame &frame = snapshots.back();
+    frame.ids.resize(count);
+    unsigned int *next_ids = frame.ids.data(), *ids = particle_ids.data();
+    bool had_ids = reordered;
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            next_ids[i] = had_ids ? ids[order[i]] : order[i];
+        }
+    });
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        std::copy(next_ids + first, next_ids + last, ids + first);
+    });
+    reordered = true;
+    frame.reordered = true;
+    frame.ids_version = ++ids_version;
+    reorder_count++;
+    // same step in the new order, the grid is renumbered, the lists hold old indices
+    publish_positions();
+    grid.renumber(order.data(), count, pool);
+    verlet.invalidate();
 }
 
-void Fluid2D::acceleration(const std::vector<vec2 > &position,
-                           const std::vector<vec2 > &velocity,
-                           std::vector<vec2 > &acc) {
-    // foreach grid cell, calculate all neighbours
-    std::vector<std::vector<int> > all_groups(grid_col * grid_raw);
-    std::vector<float> pho(params.particle_count);
-    std::vector<std::function<void(void)>> tasks;
-    for (int i = 0; i < grid_raw; i++) {
-        for (int j = 0; j < grid_col; j++) {
-            // all particles indices in a 3 x 3 grid whose center is cell
-            std::vector<int> group;
-            for (int k = -1; k < 2; k++) {
-                for (int d = -1; d < 2; d++) {
-                    if (inGrid(j + k, i + d)) {
-                        for (int index: cellAt(j + k, i + d)) {
-                            group.push_back(index);
-                        }
-                    }
+void Fluid2D::update_neighbour_lists() {
+    const float *x = particles.x, *y = particles.y;
+    if (verlet.needsRebuild(x, y, params.particle_count, pool) || verlet.isForward() != params.symmetric_pairs) {
+        // the grid is only refreshed with the lists, it is at most skin / 2 behind
+        index_all_particles();
+        verlet.build(grid, x, y, params.particle_count, params.h, params.verlet_skin, params.symmetric_pairs, pool);
+    }
+}
+
+// SIMD shape of a kernel, false for custom kernels
+static bool simd_shape(const SmoothKernels::SmoothKernel<D2> *kernel, SimdKernels::Shape &shape) {
+    if (kernel == nullptr) {
+        shape = SimdKernels::NONE;
+        return true;
+    }
+    switch (kernel->kind()) {
+        case SmoothKernels::POLY6:
+            shape = SimdKernels::POLY6;
+            return true;
+        case SmoothKernels::SPIKY:
+            shape = SimdKernels::SPIKY;
+            return true;
+        case SmoothKernels::VISCOSITY:
+            shape = SimdKernels::VISCOSITY;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// a closed form kernel of the pair at a time paths, one KernelPolicies policy at params.h
+template<template<class> class Policy>
+struct PairKernel {
+    using Closed = Policy<KernelPolicies::Scalar>;
+    static constexpr bool needs_r = Closed::needs_r;
+    Closed policy;
+    float h2;
+
+    PairKernel(const SimdKernels::KernelConstants &c, SimdKernels::Shape shape) : policy(c, shape), h2(c.h2) {}
+
+    bool active() const {
+        return Closed::enabled && policy.active();
+    }
+
+    // r2 = |dr|^2, r = |dr| when needs_r
+    float value(vec2 &, float r2, float r) const {
+        return r2 < h2 ? policy.value(r2, r) : 0.f;
+    }
+
+    vec2 gradient(vec2 &dr, float r2, float r) const {
+        return r2 < h2 ? dr * policy.gradient(r2, r) : vec2();
+    }
+
+    float laplacian(vec2 &, float r2, float r) const {
+        return r2 < h2 ? policy.laplacian(r2, r) : 0.f;
+    }
+};
+
+// a custom or tabulated kernel, through its SmoothKernel
+struct PointerKernel {
+    static constexpr bool needs_r = false;
+    SmoothKernels::SmoothKernel<D2> *kernel;
+
+    bool active() const {
+        return kernel != nullptr;
+    }
+
+    float value(vec2 &dr, float, float) const {
+        return (*kernel)(dr);
+    }
+
+    vec2 gradient(vec2 &dr, float, float) const {
+        return kernel->diff(dr);
+    }
+
+    float laplacian(vec2 &dr, float, float) const {
+        return kernel->laplace(dr);
+    }
+};
+
+// the kernels of an evaluation
+template<class Rho, class Pressure, class Viscous, class Tension>
+struct PairKernels {
+    static constexpr bool rho_needs_r = Rho::needs_r;
+    static constexpr bool force_needs_r = Pressure::needs_r || Viscous::needs_r || Tension::needs_r;
+    Rho rho;
+    Pressure pressure;
+    Viscous viscosity;
+    Tension tension;
+};
+
+template<template<class> class Rho, template<class> class Pressure,
+        template<class> class Viscous, template<class> class Tension, class Body>
+static void with_policies(const SimdKernels::KernelConstants &c, const SimdKernels::Shapes &s, Body &body) {
+    body(PairKernels<PairKernel<Rho>, PairKernel<Pressure>, PairKernel<Viscous>, PairKernel<Tension>>{
+            {c, s.rho}, {c, s.pressure}, {c, s.viscosity}, {c, s.tension}});
+}
+
+// run body(kernels) with the PairKernels of params. Like the SIMD backends, the kernel
+// presets of Scenario.cpp get their own instantiations and other built in combinations
+// switch on the shapes at runtime. Custom and tabulated kernels go through SmoothKernel
+template<class Body>
+static void with_kernels(const Fluid2D::Fluid2DParameters &params, Body &&body) {
+    using namespace KernelPolicies;
+    SimdKernels::Shapes s{};
+    if (!simd_shape(params.rho_kernel, s.rho) ||
+        !simd_shape(params.pressure_kernel, s.pressure) ||
+        !simd_shape(params.viscosity_kernel, s.viscosity) ||
+        !simd_shape(params.surface_tension_kernel, s.tension)) {
+        body(PairKernels<PointerKernel, PointerKernel, PointerKernel, PointerKernel>{
+                {params.rho_kernel}, {params.pressure_kernel},
+                {params.viscosity_kernel}, {params.surface_tension_kernel}});
+        return;
+    }
+    SimdKernels::KernelConstants c = SimdKernels::makeConstants(params.h);
+    Shape p = s.pressure, v = s.viscosity, t = s.tension;
+    if (s.rho != POLY6) {
+        with_policies<Dynamic, Dynamic, Dynamic, Dynamic>(c, s, body);
+    } else if (p == POLY6 && v == NONE && t == NONE) {
+        // preset 1
+        with_policies<Poly6, Poly6, Off, Off>(c, s, body);
+    } else if (p == SPIKY && v == NONE && t == NONE) {
+        // preset 2
+        with_policies<Poly6, Spiky, Off, Off>(c, s, body);
+    } else if (p == SPIKY && v == VISCOSITY && t == NONE) {
+        // preset 3
+        with_policies<Poly6, Spiky, Viscosity, Off>(c, s, body);
+    } else if (p == SPIKY && v == VISCOSITY && t == POLY6) {
+        // preset 4
+        with_policies<Poly6, Spiky, Viscosity, Poly6>(c, s, body);
+    } else {
+        with_policies<Dynamic, Dynamic, Dynamic, Dynamic>(c, s, body);
+    }
+}
+
+bool Fluid2D::simd_kernels(SimdKernels::Backend &backend,
+                           SimdKernels::Shape &rho,
+                           SimdKernels::Shape &pressure,
+                           SimdKernels::Shape &viscosity,
+                           SimdKernels::Shape &tension) const {
+    if (!params.vectorize || params.rho_kernel == nullptr) {
+        return false;
+    }
+    if (!simd_shape(params.rho_kernel, rho) ||
+        !simd_shape(params.pressure_kernel, pressure) ||
+        !simd_shape(params.viscosity_kernel, viscosity) ||
+        !simd_shape(params.surface_tension_kernel, tension)) {
+        return false;
+    }
+    backend = SimdKernels::backend(params.kernel_isa, SimdKernels::Shapes{rho, pressure, viscosity, tension});
+    return true;
+}
+
+const char *Fluid2D::kernelPath() const {
+    SimdKernels::Backend backend{};
+    SimdKernels::Shape rho, pressure, viscosity, tension;
+    if (simd_kernels(backend, rho, pressure, viscosity, tension)) {
+        return SimdKernels::isaName(backend.isa);
+    }
+    return "generic";
+}
+
+void Fluid2D::gather_neighbours(int particle, int cell_x, int cell_y, bool with_self, std::vector<int> &out) {
+    out.clear();
+    forEachNeighbour(particle, cell_x, cell_y, [&](int other) {
+        if ((with_self || other != particle) && !isSeperatedByBoundaries(particle, other)) {
+            out.push_back(other);
+        }
+    });
+}
+
+vec2 Fluid2D::surface_normal(int j, int i) {
+    // get color field gradient
+    vec2 n;
+    unsigned int blocked = 0;
+    if (grid.isHashed()) {
+        vec2 cell_center(j + 0.5, i + 0.5);
+        for (int k = -1; k < 2; k++) {
+            for (int d = -1; d < 2; d++) {
+                vec2 other_center(j + k + 0.5, i + d + 0.5);
+                if (isSeperatedByBoundaries(cell_center, other_center)) {
+                    blocked |= 1 << ((d + 1) * 3 + k + 1);
                 }
             }
-            all_groups[i * grid_col + j] = group;
         }
+    } else {
+        blocked = centre_blocked[i * grid.columns() + j];
     }
-    // calculate pho
-    for (int i = 0; i < grid_raw; i++) {
-        for (int j = 0; j < grid_col; j++) {
-            for (int particle: cellAt(j, i)) {
-                tasks.emplace_back([&position, &pho, particle, i, j, this, &all_groups]() {
-                    float p = 0;
-                    vec2 pos = position[particle];
-                    for (int other: all_groups[i * grid_col + j]) {
-                        if (!isSeperatedByBoundaries(particle, other, position)) {
-                            vec2 other_pos = position[other];
-                            vec2 dr = pos - other_pos;
-                            p = p + params.particle_mass * (*params.rho_kernel)(dr);
-                        }
+    for (int k = -1; k < 2; k++) {
+        for (int d = -1; d < 2; d++) {
+            if (!(k == 0 && d == 0) && inGrid(j + k, i + d)) {
+                if (cellAt(j + k, i + d).empty() || (blocked >> ((d + 1) * 3 + k + 1)) & 1) {
+                    n.x() -= float(k);
+                    n.y() -= float(d);
+                }
+            }
+        }
+    }
+    return n;
+}
+
+void Fluid2D::acceleration(const float *vel_x, const float *vel_y) {
+    with_kernels(params, [&](const auto &kernels) {
+        if (params.symmetric_pairs) {
+            acceleration_symmetric(vel_x, vel_y, kernels);
+        } else {
+            acceleration_cells(vel_x, vel_y, kernels);
+        }
+    });
+}
+
+template<class Kernels>
+void Fluid2D::acceleration_cells(const float *vel_x, const float *vel_y, const Kernels &kernels) {
+    const float *x = particles.x, *y = particles.y;
+    float *rho = particles.rho.data(), *pressure = particles.p.data();
+    const float *inv_rho = particles.inv_rho.data();
+    bool fused = params.fused_eos;
+
+    // vectorized kernels
+    SimdKernels::Backend backend{};
+    SimdKernels::Shape rho_shape, pressure_shape, viscosity_shape, tension_shape;
+    bool simd = simd_kernels(backend, rho_shape, pressure_shape, viscosity_shape, tension_shape);
+    SimdKernels::KernelConstants constants = SimdKernels::makeConstants(params.h);
+    SimdKernels::DensityArgs density_args{x, y, 0, 0, params.particle_mass, rho_shape, constants};
+    SimdKernels::ForceArgs force_args{x, y, vel_x, vel_y, inv_rho, pressure, 0, 0, 0, 0, 0, params.V,
+                                      pressure_shape, viscosity_shape, tension_shape, constants};
+
+    const std::vector<CellGrid::Cell> &cells = grid.occupied();
+    bool tiled = params.tile_size > 0;
+
+    // calculate pho of the particles of occupied cell c, and pressure and 1 / pho when fused
+    auto density_cell = [&](int c) {
+        std::vector<int> &neighbours = workspace.neighbours[pool->slot()];
+        int i = cells[c].y, j = cells[c].x;
+        for (int particle: grid.cellRange(cells[c].id)) {
+            if (simd) {
+                gather_neighbours(particle, j, i, true, neighbours);
+                SimdKernels::DensityArgs args = density_args;
+                args.px = args.x[particle];
+                args.py = args.y[particle];
+                rho[particle] = backend.density(args, neighbours.data(), int(neighbours.size()));
+            } else {
+                float p = 0;
+                float pos_x = x[particle], pos_y = y[particle];
+                forEachNeighbour(particle, j, i, [&](int other) {
+                    if (!isSeperatedByBoundaries(particle, other)) {
+                        vec2 dr(pos_x - x[other], pos_y - y[other]);
+                        float r2 = dr.Mul(dr);
+                        float r = Kernels::rho_needs_r ? std::sqrt(r2) : r2;
+                        p = p + params.particle_mass * kernels.rho.value(dr, r2, r);
                     }
-                    pho[particle] = p;
                 });
+                rho[particle] = p;
+            }
+            if (fused || tiled) {
+                equation_of_state(particle);
             }
         }
+    };
+    // get acceleration of the particles of occupied cell c
+    auto force_cell = [&](int c) {
+        if (!this->is_running) { return; }
+        int i = cells[c].y, j = cells[c].x;
+        // for all particle in the cell, calculate all acceleration
+        vec2 n = surface_normal(j, i);
+        for (int particle: grid.cellRange(cells[c].id)) {
+            if (simd) {
+                acceleration_at_simd(particle, n, j, i, force_args, backend.force);
+            } else {
+                acceleration_at(particle, n, j, i, vel_x, vel_y, kernels);
+            }
+        }
+    };
+
+    if (tiled) {
+        // the forces of a tile read the densities of cells within reach, tiles are at least that large
+        int reach = params.verlet_skin > 0 ? verlet.reach() : 1;
+        tile_graph.build(cells, std::max(int(params.tile_size), reach));
+        tile_graph.run(pool, density_cell, force_cell);
+        return;
     }
-    pool->syncGroup(tasks, tasks.size() / 200);
 
-    // get acceleration
-    tasks.clear();
-    for (int i = 0; i < grid_raw; i++) {
-        for (int j = 0; j < grid_col; j++) {
-            // for all particle in the cell, calculate all acceleration
-            if (cellAt(j, i).size() > 0) {
-                // get color field gradient
-                vec2 n;
-                vec2 cell_center(j + 0.5, i + 0.5);
-                for (int k = -1; k < 2; k++) {
-                    for (int d = -1; d < 2; d++) {
-                        if (!(k == 0 && d == 0) && inGrid(j + k, i + d)) {
-                            vec2 other_center(j + k + 0.5, i + d + 0.5);
-                            if (cellAt(j + k, i + d).empty() || isSeperatedByBoundaries(cell_center, other_center)) {
-                                n.x() -= float(k);
-                                n.y() -= float(d);
-                            }
-                        }
+    // a range of occupied cells per chunk, several chunks per worker to balance uneven cells
+    int grain = std::max(1, int(cells.size()) / (8 * std::max(1, int(pool->size()))));
+    pool->parallel_for(0, int(cells.size()), grain, [&](int first, int last) {
+        for (int c = first; c < last; c++) {
+            density_cell(c);
+        }
+    });
+    if (!fused) {
+        equation_of_state();
+    }
+    pool->parallel_for(0, int(cells.size()), grain, [&](int first, int last) {
+        for (int c = first; c < last; c++) {
+            force_cell(c);
+        }
+    });
+}
+
+template<typename Body>
+void Fluid2D::for_each_band(int height, Body &&body) {
+    const std::vector<CellGrid::Cell> &cells = grid.occupied();
+    if (cells.empty()) {
+        return;
+    }
+    // bands start at row 0 of the dense grid, or at the lowest occupied row
+    int first_row = grid.isHashed() ? cells.front().y : 0;
+    int bands = (cells.back().y - first_row) / height + 1;
+    auto band_begin = [&](int band) {
+        int row = first_row + band * height;
+        return int(std::lower_bound(cells.begin(), cells.end(), row, [](const CellGrid::Cell &cell, int r) {
+            return cell.y < r;
+        }) - cells.begin());
+    };
+    for (int colour = 0; colour < 2; colour++) {
+        pool->syncChunks((bands - colour + 1) / 2, [&](int t) {
+            int band = 2 * t + colour;
+            body(band_begin(band), band_begin(band + 1));
+        });
+    }
+}
+
+void Fluid2D::equation_of_state() {
+    pool->parallel_for(0, int(params.particle_count), 4096, [this](int first, int last) {
+        for (int i = first; i < last; i++) {
+            equation_of_state(i);
+        }
+    });
+}
+
+template<class Kernels>
+void Fluid2D::acceleration_symmetric(const float *vel_x, const float *vel_y, const Kernels &kernels) {
+    // Every pair (i, j) is visited from the particle earlier in cell order and
+    // written to both. A particle only reaches particles in its own row of cells
+    // up to band_height rows above, so two bands one band apart never write
+    // to the same particle.
+    int band_height = params.verlet_skin > 0 ? verlet.reach() : 1;
+    int count = params.particle_count;
+    const float *x = particles.x, *y = particles.y;
+    float *rho = particles.rho.data();
+    const float *pressure = particles.p.data();
+    float *ax = particles.ax.data(), *ay = particles.ay.data();
+    workspace.kappa.resize(count);
+    workspace.cell_normals.resize(grid.cellIds());
+    const std::vector<CellGrid::Cell> &cells = grid.occupied();
+
+    /* density */
+    vec2 zero;
+    float self_rho = params.particle_mass * kernels.rho.value(zero, 0.f, 0.f);
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        std::fill(rho + first, rho + last, self_rho);
+    });
+    for_each_band(band_height, [&](int first_cell, int last_cell) {
+        for (int c = first_cell; c < last_cell; c++) {
+            int i = cells[c].y, j = cells[c].x;
+            for (int particle: grid.cellRange(cells[c].id)) {
+                float pos_x = x[particle], pos_y = y[particle];
+                forEachForwardNeighbour(particle, j, i, [&](int other) {
+                    if (!isSeperatedByBoundaries(particle, other)) {
+                        vec2 dr(pos_x - x[other], pos_y - y[other]);
+                        float r2 = dr.Mul(dr);
+                        float r = Kernels::rho_needs_r ? std::sqrt(r2) : r2;
+                        float p = params.particle_mass * kernels.rho.value(dr, r2, r);
+                        rho[particle] += p;
+                        rho[other] += p;
                     }
-                }
-                for (int particle: cellAt(j, i)) {
-                    tasks.emplace_back([this, particle, i, j, &all_groups, n, &position, &velocity, &pho, &acc]() {
-                        if (!this->is_running) { return; }
-                        acceleration_at(particle,
-                                        n,
-                                        all_groups[i * grid_col + j],
-                                        position,
-                                        velocity,
-                                        pho,
-                                        acc);
+                });
+            }
+        }
+    });
+    // rho is summed from both sides of a pair, so the state follows in its own pass
+    equation_of_state();
+    const float *inv_rho = particles.inv_rho.data();
+
+    /* forces */
+    float *kappa = workspace.kappa.data();
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        std::fill(ax + first, ax + last, 0.f);
+        std::fill(ay + first, ay + last, 0.f);
+        std::fill(kappa + first, kappa + last, 0.f);
+    });
+    if (kernels.pressure.active()) {
+        for_each_band(band_height, [&](int first_cell, int last_cell) {
+            if (!this->is_running) { return; }
+            for (int c = first_cell; c < last_cell; c++) {
+                int i = cells[c].y, j = cells[c].x;
+                for (int particle: grid.cellRange(cells[c].id)) {
+                    float pos_x = x[particle], pos_y = y[particle];
+                    forEachForwardNeighbour(particle, j, i, [&](int other) {
+                        if (isSeperatedByBoundaries(particle, other)) {
+                            return;
+                        }
+                        vec2 dr(pos_x - x[other], pos_y - y[other]);
+                        float r2 = dr.Mul(dr);
+                        float r = Kernels::force_needs_r ? std::sqrt(r2) : r2;
+                        /* pressure, diff_W(-r) = -diff_W(r) */
+                        if (kernels.pressure.active()) {
+                            vec2 d_w = kernels.pressure.gradient(dr, r2, r);
+                            float p_sum = -0.5f * (pressure[particle] + pressure[other]);
+                            ax[particle] += d_w.x() * (p_sum * inv_rho[other]);
+                            ay[particle] += d_w.y() * (p_sum * inv_rho[other]);
+                            ax[other] -= d_w.x() * (p_sum * inv_rho[particle]);
+                            ay[other] -= d_w.y() * (p_sum * inv_rho[particle]);
+                        }
+                        /* viscosity */
+                        if (kernels.viscosity.active()) {
+                            float l = kernels.viscosity.laplacian(dr, r2, r) * params.V;
+                            float dv_x = vel_x[other] - vel_x[particle];
+                            float dv_y = vel_y[other] - vel_y[particle];
+                            ax[particle] += dv_x * (l * inv_rho[other]);
+                            ay[particle] += dv_y * (l * inv_rho[other]);
+                            ax[other] -= dv_x * (l * inv_rho[particle]);
+                            ay[other] -= dv_y * (l * inv_rho[particle]);
+                        }
+                        /* surface tension, normals are applied per particle below */
+                        if (kernels.tension.active()) {
+                            float l = kernels.tension.laplacian(dr, r2, r);
+                            kappa[particle] -= l * inv_rho[other];
+                            kappa[other] -= l * inv_rho[particle];
+                        }
                     });
                 }
             }
-        }
+        });
     }
-    pool->syncGroup(tasks, params.particle_count / 200);
+
+    // gravity and surface tension
+    bool tension = kernels.pressure.active() && kernels.tension.active();
+    if (tension) {
+        pool->parallel_for(0, int(cells.size()), 256, [&](int first, int last) {
+            for (int c = first; c < last; c++) {
+                workspace.cell_normals[cells[c].id] = surface_normal(cells[c].x, cells[c].y);
+            }
+        });
+    }
+    pool->parallel_for(0, count, 4096, [&](int first, int last) {
+        for (int i = first; i < last; i++) {
+            vec2 ac(params.gravity);
+            ac.x() += ax[i];
+            ac.y() += ay[i];
+            int cell = grid.cellOf(i);
+            if (tension && cell >= 0) {
+                vec2 n = workspace.cell_normals[cell];
+                float norm = n.length();
+                if (norm > std::numeric_limits<float>::epsilon()) {
+                    vec2 t = n * (kappa[i] / norm * params.sigma);
+                    ac = ac + t;
+                }
+            }
+            ax[i] = ac.x();
+            ay[i] = ac.y();
+        }
+    });
 }
 
+template<class Kernels>
 void Fluid2D::acceleration_at(int p_index,
                               vec2 surf_n,
-                              const std::vector<int> &neighbours,
-                              const std::vector<vec2 > &position,
-                              const std::vector<vec2 > &velocity,
-                              const std::vector<float> &pho_s,
-                              std::vector<vec2 > &acc) {
+                              int cell_x,
+                              int cell_y,
+                              const float *vel_x,
+                              const float *vel_y,
+                              const Kernels &kernels) {
+    const float *x = particles.x, *y = particles.y;
+    const float *inv_rho = particles.inv_rho.data(), *pressure_s = particles.p.data();
     // key function, calculate all accelerations
     //* external forces: */
     /// gravity
     vec2 ac = params.gravity;
-    vec2 pos = position[p_index];
-    vec2 vel = velocity[p_index];
-    float rho_p = pho_s[p_index];
-    float pr = params.K * (rho_p - params.rho_0);
+    float pos_x = x[p_index], pos_y = y[p_index];
+    vec2 vel(vel_x[p_index], vel_y[p_index]);
+    float pr = pressure_s[p_index];
+    // surface tension only if the normal is defined
+    float norm = surf_n.length();
+    bool tension = kernels.tension.active() && norm > std::numeric_limits<float>::epsilon();
+    float kappa = 0;
 
     /* internal force */
-    if (params.pressure_kernel != nullptr) {
-        for (int other: neighbours) {
-            if (other != p_index && !isSeperatedByBoundaries(p_index, other, position)) {
-                vec2 other_pos = position[other];
-                vec2 dr = pos - other_pos;
+    if (kernels.pressure.active()) {
+        forEachNeighbour(p_index, cell_x, cell_y, [&](int other) {
+            if (other != p_index && !isSeperatedByBoundaries(p_index, other)) {
+                vec2 dr(pos_x - x[other], pos_y - y[other]);
+                float r2 = dr.Mul(dr);
+                float r = Kernels::force_needs_r ? std::sqrt(r2) : r2;
                 /* pressure */
                 // f_pressure = - m * (p_i +p_j) / (2 * pho_j) * diff_W(r, h)
                 // a_pressure = f / m = - (p_i +p_j) / (2 * pho_j) * diff_W(r, h)
                 // p = K * (pho - pho_0)
-                if (params.pressure_kernel != nullptr) {
-                    vec2 pressure = params.pressure_kernel->diff(dr) *
-                                    (-0.5f * (params.K * (pho_s[other] - params.rho_0) + pr) / pho_s[other]);
+                if (kernels.pressure.active()) {
+                    vec2 pressure = kernels.pressure.gradient(dr, r2, r) *
+                                    (-0.5f * (pressure_s[other] + pr) * inv_rho[other]);
                     ac = ac + pressure;
                 }
                 /* viscosity */
                 // f_viscosity = miu * m * (vj - vi) / pho_j * laplace_W(r, h)
                 // a_viscosity = miu * (vj - vi) / pho_j * laplace_W(r, h)
-                if (params.viscosity_kernel != nullptr) {
-                    vec2 d_v = velocity[other];
+                if (kernels.viscosity.active()) {
+                    vec2 d_v(vel_x[other], vel_y[other]);
                     d_v = d_v - vel;
                     vec2 viscosity =
-                            d_v * (params.viscosity_kernel->laplace(dr) * params.V / pho_s[other]);
+                            d_v * (kernels.viscosity.laplacian(dr, r2, r) * params.V * inv_rho[other]);
                     ac = ac + viscosity;
                 }
 
                 /* surface tension */
-                // f_tension = sigma * kappa * normal
-                // kappa = - m * laplace_W(r, h) / (pho_j * |normal|)
-                if (params.surface_tension_kernel != nullptr) {
-                    float norm = surf_n.length();
-                    if (norm > std::numeric_limits<float>::epsilon()) {
-                        float kappa = -params.surface_tension_kernel->laplace(dr) / (pho_s[other] * norm);
-                        vec2 tension = surf_n * (kappa * params.sigma);
-                        ac = ac + tension;
-                    }
+                // kappa = sum(- laplace_W(r, h) / pho_j), divided by |normal| below
+                if (tension) {
+                    kappa -= kernels.tension.laplacian(dr, r2, r) * inv_rho[other];
                 }
 
             }
+        });
+        // f_tension = sigma * kappa * normal
+        if (tension) {
+            vec2 tension_force = surf_n * (kappa / norm * params.sigma);
+            ac = ac + tension_force;
         }
     }
 
-    acc[p_index] = ac;
-}
-
-void Fluid2D::update_boundary(int p_index, std::vector<vec2 > &position, std::vector<vec2 > &velocity) const {
-    vec2 pos = position[p_index];
-    if (pos.x() <= params.left) {
-        position[p_index].x() = params.left + std::numeric_limits<float>::epsilon();
-        velocity[p_index].x() = 0;
-    } else if (pos.x() >= params.right) {
-        position[p_index].x() = params.right - std::numeric_limits<float>::epsilon();
-        velocity[p_index].x() = - 0;
-    }
-    if (pos.y() <= params.bottom) {
-        position[p_index].y() = params.bottom + std::numeric_limits<float>::epsilon();
-        velocity[p_index].y() = 0;
-    } else if (pos.y() >= params.top) {
-        position[p_index].y() = params.top - std::numeric_limits<float>::epsilon();
-        velocity[p_index].y() = -0;
-    }
-}
-
-void Fluid2D::render() {
-    glScalef(scale, scale, scale);
-    float center_x = (params.left + params.right) / 2;
-    float center_y = (params.top + params.bottom) / 2;
-    glTranslatef(- center_x, - center_y, 0);
-    // render grid
-    glColor3f(0.1, 0.1, 0.1);
-    glLineWidth(1);
-    glBegin(GL_LINES);
-    float grid_w = (params.right - params.left + params.h) / float(grid_col);
-    float grid_h = (params.top - params.bottom + params.h) / float(grid_raw);
-    for (unsigned int x = 0; x <= grid_col; x++) {
-        glVertex3f( grid_w * x - params.h / 2, params.top+ params.h / 2, 0);
-        glVertex3f(grid_w * x - params.h / 2, params.bottom - params.h / 2, 0);
-    }
-    for (unsigned int y = 0; y <= grid_raw; y++) {
-        glVertex3f(params.left - params.h / 2, grid_h * y - params.h / 2, 0);
-        glVertex3f(params.right + params.h / 2, grid_h * y - params.h / 2, 0);
-    }
-    glEnd();
-
-    // render particles
-    glColor3f(0.3, 0.5, 0.8);
-    glPointSize(4);
-    glBegin(GL_POINTS);
-    std::unique_lock<std::mutex> lk(this->swap_mutex);
-    std::vector<vec2 > lock_positions = back_positions;
-    lk.unlock();
-    for (vec2 &p: lock_positions) {
-        glVertex3f(p.x(), p.y(), 0);
-    }
-    glEnd();
+    particles.ax[p_index] = ac.x();
+    particles.ay[p_index] = ac.y();
+}
 
+void Fluid2D::acceleration_at_simd(int p_index,
+                                   vec2 surf_n,
+                                   int cell_x,
+                                   int cell_y,
+                                   const SimdKernels::ForceArgs &args,
+                                   SimdKernels::ForceFunction force) {
+    // same terms as acceleration_at, summed over the neighbour list at once
+    vec2 ac = params.gravity;
+    if (params.pressure_kernel != nullptr) {
+        std::vector<int> &neighbours = workspace.neighbours[pool->slot()];
+        gather_neighbours(p_index, cell_x, cell_y, false, neighbours);
+        SimdKernels::ForceArgs a = args;
+        a.px = a.x[p_index];
+        a.py = a.y[p_index];
+        a.vxi = a.vx[p_index];
+        a.vyi = a.vy[p_index];
+        a.pi = a.p[p_index];
+        // surface tension only if the normal is defined
+        float norm = surf_n.length();
+        if (norm <= std::numeric_limits<float>::epsilon()) {
+            a.tension = SimdKernels::NONE;
+        }
+        SimdKernels::ForceSum sum = force(a, neighbours.data(), int(neighbours.size()));
+        ac.x() += sum.ax;
+        ac.y() += sum.ay;
+        if (a.tension != SimdKernels::NONE) {
+            // f_tension = sigma * kappa * normal, kappa = sum(- laplace_W / pho_j) / |normal|
+            vec2 tension = surf_n * (sum.kappa / norm * params.sigma);
+            ac = ac + tension;
+        }
+    }
+    particles.ax[p_index] = ac.x();
+    particles.ay[p_index] = ac.y();
+}
+
+void Fluid2D::update_boundary(int p_index, float *vel_x, float *vel_y) {
+    float pos_x = particles.x[p_index];
+    float pos_y = particles.y[p_index];
+    if (pos_x <= params.left) {
+        particles.x[p_index] = params.left + std::numeric_limits<float>::epsilon();
+        vel_x[p_index] = 0;
+    } else if (pos_x >= params.right) {
+        particles.x[p_index] = params.right - std::numeric_limits<float>::epsilon();
+        vel_x[p_index] = - 0;
+    }
+    if (pos_y <= params.bottom) {
+        particles.y[p_index] = params.bottom + std::numeric_limits<float>::epsilon();
+        vel_y[p_index] = 0;
+    } else if (pos_y >= params.top) {
+        particles.y[p_index] = params.top - std::numeric_limits<float>::epsilon();
+        vel_y[p_index] = -0;
+    }
 }
 
 Fluid2D::~Fluid2D() {
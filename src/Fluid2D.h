@@ -1,25 +1,25 @@
 #ifndef FLUID_2D_H
 #define FLUID_2D_H
 
-#include "GLRenderable.h"
 #include "Vec.h"
 #include <vector>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <unordered_set>
 #include <type_traits>
 #include "SmoothKernels.h"
+#include "SimdKernels.h"
 #include "ThreadPool.h"
-
-class BoundaryI {
-public:
-    virtual void updateCS(float top, float bottom, float right, float left) = 0;
-    // index : particle index
-    // next_pos : check next position with the boundary
-    // all_pos, all_vel : particles positions and velocities
-    virtual bool updateAt(int index, vec2 next_pos, std::vector<vec2> &all_pos, std::vector<vec2> &all_vel) = 0;
-    virtual bool isSeperated(vec2 a, vec2 b) = 0;
-};
-
-class Fluid2D final : public GLRenderableI {
+#include "Particles.h"
+#include "CellGrid.h"
+#include "NeighbourList.h"
+#include "TripleBuffer.h"
+#include "Boundary.h"
+#include "BoundaryIndex.h"
+#include "TileGraph.h"
+
+class Fluid2D final {
 public:
     struct Fluid2DParameters {
         // time step
@@ -29,7 +29,7 @@ public:
         float bottom;
         float left;
         float right;
-        // h in kernel function
+        // smoothing length, the built in kernels are evaluated at it on every path
         float h;
         // gravity
         vec2 gravity;
@@ -48,6 +48,65 @@ public:
         // surface tension, disabled when σ == 0
         float sigma;
 
+        // index particles in a hash table of occupied cells instead of a dense grid
+        // over the domain box, read when the solver is initialized
+        bool hashed_grid;
+        // keep particles inside the domain box, the dense grid drops particles outside of it
+        bool clamp_to_domain;
+
+        // every reorder_interval steps sort the particles by the Morton (Z-order) key of
+        // their cell, so particles close in space stay close in memory. 0 never reorders,
+        // PositionFrame::ids maps indices back to the initial order
+        unsigned int reorder_interval;
+
+        // skin radius of the Verlet neighbour lists, lists are disabled when 0
+        // and neighbours are searched in the grid every step
+        float verlet_skin;
+
+        // evaluate the built in kernels several neighbours at a time, with the best
+        // instruction set up to kernel_isa. Custom kernels always use the function pointers
+        bool vectorize;
+        SimdKernels::ISA kernel_isa;
+
+        // evaluate every pair once and apply it to both particles,
+        // custom kernels included, vectorize is ignored
+        bool symmetric_pairs;
+
+        // write pressure and 1 / rho right after the density of a particle in the
+        // density sweep, instead of in a separate pass over all particles.
+        // The symmetric path always uses the separate pass
+        bool fused_eos;
+
+        // pick the time step every step from the particle state instead of delta_t,
+        // the smallest of
+        //   cfl_factor * h / |v|_max
+        //   force_factor * sqrt(h / |a|_max)
+        //   viscosity_factor * h^2 * rho_0 / V
+        // clamped to [dt_min, dt_max]
+        bool adaptive_dt;
+        float dt_min;
+        float dt_max;
+        float cfl_factor;
+        float force_factor;
+        float viscosity_factor;
+
+        // run density and forces over tiles of tile_size x tile_size cells, the forces of a
+        // tile start once the densities of its neighbour tiles are done, see TileGraph.
+        // 0 runs the two passes over the whole domain with a barrier in between.
+        // Ignored by the symmetric path
+        unsigned int tile_size;
+
+        // worker pool task queue, lock free with spinning idle workers, or the mutex queue
+        bool lock_free_queue;
+        // solver workers, 0 for one per cpu available to the process. Pinned workers stay
+        // on one cpu each. CFD_2D_THREADS and CFD_2D_PIN (0 / 1) in the environment
+        // override both, so batch jobs can size the pool without rebuilding
+        unsigned int worker_count;
+        bool pin_workers;
+        // run every pass on the calling thread with a pool without workers, ignores
+        // worker_count. The reference of parallel runs, results must not differ from it
+        bool serial;
+
         // callbacks
         // initial 
         void (*init_positions)(std::vector<vec2 > &positions, float top, float bottom, float left, float right);
@@ -61,7 +120,14 @@ public:
         Fluid2DParameters():
                 top(1), bottom(-1), left(-1), right(1), h(1), delta_t(0.05),
                 particle_count(1000), particle_mass(1), gravity(vec2(0, -1)),
-                rho_0(1), K(1), V(1), sigma(1), init_positions(nullptr),
+                rho_0(1), K(1), V(1), sigma(1),
+                hashed_grid(false), clamp_to_domain(true), reorder_interval(0), verlet_skin(0),
+                vectorize(true), kernel_isa(SimdKernels::AVX512), symmetric_pairs(false),
+                fused_eos(true),
+                adaptive_dt(false), dt_min(0.005), dt_max(0.5),
+                cfl_factor(0.4), force_factor(0.25), viscosity_factor(0.125),
+                tile_size(0), lock_free_queue(true), worker_count(0), pin_workers(false), serial(false),
+                init_positions(nullptr),
                 rho_kernel(nullptr),
                 pressure_kernel(nullptr),
                 viscosity_kernel(nullptr),
@@ -70,16 +136,35 @@ public:
         }
     };
 
-    explicit Fluid2D(Fluid2DParameters &params);
+    // particles and counters of a run after a finished step, enough to continue it.
+    // Views into the solver or into a checkpoint, see Checkpoint
+    struct State {
+        unsigned int count;
+        unsigned long step;
+        unsigned long reorders;
+        double simulated_time;
+        float last_dt;
+        const float *x, *y, *vx, *vy, *ax, *ay, *rho, *p, *inv_rho;
+        // initial index of each particle, nullptr while particles keep their initial order
+        const unsigned int *ids;
+        // positions the Verlet lists were built from, nullptr without valid lists.
+        // Restoring builds the same grid and lists again, so neighbours keep their order
+        const float *list_x, *list_y;
+    };
 
-    ~Fluid2D() final;
+    explicit Fluid2D(Fluid2DParameters &params);
 
-    // update
-    void update() final;
+    ~Fluid2D();
 
-    // start simulation
+    // start simulation on the dispatcher thread
     void start();
 
+    // run steps synchronously on the calling thread, used by headless runs
+    void advance(unsigned int steps);
+
+    // run synchronously until seconds more are simulated, return the steps taken
+    unsigned int advanceTime(double seconds);
+
     void stop() {
         is_running = false;
     }
@@ -91,40 +176,175 @@ public:
     void addBoundary(std::shared_ptr<BoundaryI> b) {
         b->updateCS(params.top, params.bottom, params.right, params.left);
         boundaries.push_back(b);
+        boundary_index_dirty = true;
     }
 
+    void clearBoundaries() {
+        boundaries.clear();
+        boundary_index_dirty = true;
+    }
+
+    const std::vector<std::shared_ptr<BoundaryI>> &allBoundaries() const {
+        return boundaries;
+    }
+
+    // called on the solver thread after every step, between steps the state may be read
+    void setStepCallback(std::function<void(const Fluid2D &)> callback) {
+        step_callback = std::move(callback);
+    }
+
+    // the run so far, only while the solver is not running or from the step callback. Views last until the next step
+    State state() const;
+
+    // continue from state instead of the current particles, params.particle_count becomes
+    // state.count. Params and boundaries are not touched. Only while the solver is not running
+    void restore(const State &state);
+
     void resetWithCallback(std::function<void(void)> callback);
 
-    // render scale
-    void setScale(float s) {
-        this->scale = s;
+    // newest finished positions without copying, safe to call while running.
+    // Only one thread may read the positions, the frame stays valid until its next call
+    const PositionFrame &latestPositions() {
+        snapshots.acquire();
+        return snapshots.front();
+    }
+
+    // copy the newest finished positions in initial particle order, same rules as latestPositions
+    void copyPositions(std::vector<vec2 > &out) {
+        const PositionFrame &frame = latestPositions();
+        out.resize(frame.x.size());
+        for (size_t i = 0; i < out.size(); i++) {
+            out[frame.id(i)] = vec2(frame.x[i], frame.y[i]);
+        }
+    }
+
+    // how many times the particles have been reordered, see reorder_interval
+    unsigned long reorders() const {
+        return reorder_count;
+    }
+
+    // how many times the Verlet neighbour lists have been built
+    unsigned long neighbourListRebuilds() const {
+        return verlet.rebuilds();
+    }
+
+    // time step of the last step, delta_t unless adaptive_dt is on
+    float timeStep() const {
+        return last_dt;
+    }
+
+    // simulated time since init
+    double simulatedTime() const {
+        return simulated_time;
+    }
+
+    // "generic" for the function pointer kernels, otherwise the SIMD instruction set
+    const char *kernelPath() const;
+
+    // threads in the worker pool, and how many of them are pinned to a cpu
+    unsigned int workers() const {
+        return pool->size();
+    }
+
+    unsigned int pinnedWorkers() const {
+        return pool->pinned();
+    }
+
+    int gridRows() const {
+        return grid.rows();
+    }
+
+    int gridColumns() const {
+        return grid.columns();
     }
+
     // simulation params
     Fluid2DParameters params;
 
 private:
-    // particles position
-    std::vector<vec2 > positions;
-    // used for buffer swapped
-    std::vector<vec2 > back_positions;
-    // particles velocity
-    std::vector<vec2 > velocities;
-    // current accelerations
-    std::vector<vec2 > acc_s;
+    // particles positions, velocities, accelerations and densities
+    ParticleSoA particles;
+    // buffers of one step, sized on first use and reused so steady state steps don't allocate
+    struct Workspace {
+        // leap frog half step velocities
+        nano_std::aligned_vector<float> half_vx;
+        nano_std::aligned_vector<float> half_vy;
+        // surface tension sum of the symmetric pass
+        nano_std::aligned_vector<float> kappa;
+        // surface normal of every cell
+        std::vector<vec2 > cell_normals;
+        // (Morton key, occupied cell) of the last reorder, first new index of each cell,
+        // old index of each new index, and the array being permuted
+        std::vector<std::pair<unsigned long long, int>> reorder_keys;
+        std::vector<int> reorder_start;
+        std::vector<int> reorder_order;
+        nano_std::aligned_vector<float> reorder_scratch;
+        // neighbour indices of the particle being evaluated, one list per pool slot
+        std::vector<std::vector<int>> neighbours;
+    } workspace;
+    // position frames, the solver drifts into the back frame and publishes it
+    nano_std::TripleBuffer<PositionFrame> snapshots;
+    unsigned long step_count{0};
+    // external id of each particle, valid once reordered is set
+    std::vector<unsigned int> particle_ids;
+    bool reordered{false};
+    // changed with particle_ids, frames holding an older version copy them on publish
+    unsigned long ids_version{0};
+    unsigned long reorder_count{0};
+    // accelerations are not computed yet, set by init
+    bool needs_acceleration{true};
+    std::function<void(const Fluid2D &)> step_callback;
     // boundaries
     std::vector<std::shared_ptr<BoundaryI>> boundaries;
+    // boundaries by grid cell, rebuilt when the boundaries or the grid change
+    BoundaryIndex boundary_index;
+    bool boundary_index_dirty{true};
+    // bit (d + 1) * 3 + k + 1 is set if boundaries separate the centre of a cell
+    // from its neighbour (k, d), for the surface normal
+    std::vector<unsigned short> centre_blocked;
 
     // a grid used for acceleration
-    std::vector<std::vector<int> > grid;
-    int grid_raw;
-    int grid_col;
+    CellGrid grid;
+    // time step of the last step and the time simulated so far
+    float last_dt{0};
+    double simulated_time{0};
 
     inline bool inGrid(int x, int y) const {
-        return x < grid_col && x >= 0 && y < grid_raw && y >= 0;
+        return grid.inGrid(x, y);
     }
 
-    inline std::vector<int> &cellAt(int x, int y) {
-        return grid[y * grid_col + x];
+    inline CellGrid::Range cellAt(int x, int y) const {
+        return grid.cellAt(x, y);
+    }
+
+    // Verlet neighbour lists, used when params.verlet_skin > 0
+    NeighbourList verlet;
+
+    // tiles of the occupied cells, used when params.tile_size > 0
+    TileGraph tile_graph;
+
+    // call visit(other) once per pair, for symmetric_pairs
+    template<typename Visitor>
+    inline void forEachForwardNeighbour(int particle, int cell_x, int cell_y, Visitor &&visit) const {
+        if (params.verlet_skin > 0) {
+            for (int other: verlet.neighbours(particle)) {
+                visit(other);
+            }
+        } else {
+            grid.forEachForwardNeighbour(particle, cell_x, cell_y, visit);
+        }
+    }
+
+    // call visit(other) for all neighbour candidates of particle in cell (cell_x, cell_y)
+    template<typename Visitor>
+    inline void forEachNeighbour(int particle, int cell_x, int cell_y, Visitor &&visit) const {
+        if (params.verlet_skin > 0) {
+            for (int other: verlet.neighbours(particle)) {
+                visit(other);
+            }
+        } else {
+            grid.forEachNeighbour(cell_x, cell_y, visit);
+        }
     }
 
     // one simulation step
@@ -132,52 +352,105 @@ private:
 
     void index_all_particles();
 
-    void acceleration(const std::vector<vec2 > &position,
-                      const std::vector<vec2 > &velocity,
-                      std::vector<vec2 > &acc);
+    // sort all particle arrays by the Morton key of their cell, see reorder_interval
+    void reorder_particles();
+
+    // rebuild the grid and the Verlet lists once particles moved too far
+    void update_neighbour_lists();
+
+    // particle arrays, step buffers and grid for params.particle_count particles
+    void resize_storage();
+
+    // acceleration before the first step, once after init
+    void initial_acceleration();
 
+    // densities and accelerations of all particles, with velocities vel_x, vel_y
+    void acceleration(const float *vel_x, const float *vel_y);
+
+    // acceleration over the occupied cells, every particle sums its own neighbours.
+    // kernels are the closed form policies at params.h or the SmoothKernels of params
+    template<class Kernels>
+    void acceleration_cells(const float *vel_x, const float *vel_y, const Kernels &kernels);
+
+    // acceleration of particle p_index in cell (cell_x, cell_y)
+    template<class Kernels>
     void acceleration_at(int p_index,
                          vec2 surf_n,
-                         const std::vector<int> &neighbours,
-                         const std::vector<vec2 > &position,
-                         const std::vector<vec2 > &velocity,
-                         const std::vector<float> &pho_s,
-                         std::vector<vec2 > &acc);
-
-    void update_boundary(int p_index, std::vector<vec2 > &position, std::vector<vec2 > &velocity) const;
-
-    bool isSeperatedByBoundaries(int index1, int index2, const std::vector<vec2> &positions) {
-        for (auto &b : boundaries) {
-            if (b->isSeperated(positions[index1], positions[index2])) {
-                return true;
-            }
-        }
-        return false;
+                         int cell_x,
+                         int cell_y,
+                         const float *vel_x,
+                         const float *vel_y,
+                         const Kernels &kernels);
+
+    // equation of state, pressure and 1 / rho from the density of one particle
+    inline void equation_of_state(int particle) {
+        float rho = particles.rho[particle];
+        particles.p[particle] = params.K * (rho - params.rho_0);
+        particles.inv_rho[particle] = 1.f / rho;
+    }
+
+    // equation of state of all particles
+    void equation_of_state();
+
+    // surface normal of the color field at cell (x, y)
+    vec2 surface_normal(int x, int y);
+
+    // acceleration with every pair evaluated once, see symmetric_pairs
+    template<class Kernels>
+    void acceleration_symmetric(const float *vel_x, const float *vel_y, const Kernels &kernels);
+
+    // run body(first_row, last_row) for bands of height grid rows. Bands of the same
+    // colour run in parallel, bands running together are one band apart
+    template<typename Body>
+    void for_each_band(int height, Body &&body);
+
+    // vectorized version of acceleration_at, args holds everything but the particle
+    void acceleration_at_simd(int p_index,
+                              vec2 surf_n,
+                              int cell_x,
+                              int cell_y,
+                              const SimdKernels::ForceArgs &args,
+                              SimdKernels::ForceFunction force);
+
+    // neighbour candidates of particle not separated by boundaries
+    void gather_neighbours(int particle, int cell_x, int cell_y, bool with_self, std::vector<int> &out);
+
+    // true if all kernels have a SIMD form and vectorize is on
+    bool simd_kernels(SimdKernels::Backend &backend,
+                      SimdKernels::Shape &rho,
+                      SimdKernels::Shape &pressure,
+                      SimdKernels::Shape &viscosity,
+                      SimdKernels::Shape &tension) const;
+
+    // time step of the next step, see adaptive_dt
+    float time_step();
+
+    void update_boundary(int p_index, float *vel_x, float *vel_y);
+
+    // point particles.x, y at the back frame, sized for all particles
+    void next_positions();
+
+    // publish the back frame for latestPositions
+    void publish_positions();
+
+    // rebuild boundary_index if needed
+    void update_boundary_index();
+
+    bool isSeperatedByBoundaries(int index1, int index2) {
+        return boundary_index.isSeperated(particles.position(index1), particles.position(index2));
     }
 
     bool isSeperatedByBoundaries(vec2 v1, vec2 v2) {
-        for (auto &b : boundaries) {
-            if (b->isSeperated(v1, v2)) {
-                return true;
-            }
-        }
-        return false;
+        return boundary_index.isSeperated(v1, v2);
     }
 
     // thread
     nano_std::WorkerThread dispatcher;
     nano_std::ThreadPool *pool;
-    std::mutex swap_mutex;
     bool is_running;
 
     // initialize
     void init();
-
-    // render fluid
-    void render();
-
-    // render parameters
-    float scale;
 };
 
 #endif // FLUID_2D_H
\ No newline at end of file
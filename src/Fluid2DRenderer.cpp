@@ -0,0 +1,37 @@
+#include "Fluid2DRenderer.h"
+
+void Fluid2DRenderer::update() {
+    const Fluid2D::Fluid2DParameters &params = fluid->params;
+    int grid_col = fluid->gridColumns();
+    int grid_raw = fluid->gridRows();
+    glScalef(scale, scale, scale);
+    float center_x = (params.left + params.right) / 2;
+    float center_y = (params.top + params.bottom) / 2;
+    glTranslatef(- center_x, - center_y, 0);
+    // render grid
+    glColor3f(0.1, 0.1, 0.1);
+    glLineWidth(1);
+    glBegin(GL_LINES);
+    float grid_w = (params.right - params.left + params.h) / float(grid_col);
+    float grid_h = (params.top - params.bottom + params.h) / float(grid_raw);
+    for (unsigned int x = 0; x <= grid_col; x++) {
+        glVertex3f( grid_w * x - params.h / 2, params.top+ params.h / 2, 0);
+        glVertex3f(grid_w * x - params.h / 2, params.bottom - params.h / 2, 0);
+    }
+    for (unsigned int y = 0; y <= grid_raw; y++) {
+        glVertex3f(params.left - params.h / 2, grid_h * y - params.h / 2, 0);
+        glVertex3f(params.right + params.h / 2, grid_h * y - params.h / 2, 0);
+    }
+    glEnd();
+
+    // render particles
+    glColor3f(0.3, 0.5, 0.8);
+    glPointSize(4);
+    glBegin(GL_POINTS);
+    const PositionFrame &frame = fluid->latestPositions();
+    for (size_t i = 0; i < frame.x.size(); i++) {
+        glVertex3f(frame.x[i], frame.y[i], 0);
+    }
+    glEnd();
+
+}
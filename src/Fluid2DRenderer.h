@@ -0,0 +1,25 @@
+#ifndef FLUID_2D_RENDERER_H
+#define FLUID_2D_RENDERER_H
+
+#include "GLRenderable.h"
+#include "Fluid2D.h"
+
+// draw the grid and particles of a running Fluid2D
+class Fluid2DRenderer final : public GLRenderableI {
+public:
+    explicit Fluid2DRenderer(std::shared_ptr<Fluid2D> f) : fluid(std::move(f)), scale(1) {}
+
+    void update() final;
+
+    // render scale
+    void setScale(float s) {
+        this->scale = s;
+    }
+
+private:
+    std::shared_ptr<Fluid2D> fluid;
+    // render parameters
+    float scale;
+};
+
+#endif // FLUID_2D_RENDERER_H
@@ -0,0 +1,243 @@
+//
+// Created by ZhangHao on 2022/12/17.
+//
+
+#ifndef CFD_2D_KERNEL_POLICIES_H
+#define CFD_2D_KERNEL_POLICIES_H
+
+#include "SimdKernels.h"
+#include <cmath>
+
+// Closed form Poly6, Spiky and Viscosity kernels as policy types, one closed form each
+// with the scale factors of a runtime h, set up once per evaluation from
+// SimdKernels::makeConstants. Every kernel loop of the solver is templated on them:
+// the SIMD backends (SimdKernelsIMPL.h) and the pair at a time paths of Fluid2D, so
+// the preset combinations compile to straight line code without shape switches or
+// function pointers, and all paths use the same h.
+// Written once against a lane type S:
+//   S::F float lanes, S::M lane mask, S::I index lanes, S::width lanes
+//   set, zero, add, sub, mul, div, sqrt, lt, both, select, lanes, indices, gather, sum
+// Scalar is the lane type of one pair at a time. Members take |r|^2 and |r| and are
+// only valid for |r| < h, callers mask the other pairs. gradient is the factor of r,
+// diff W = r * gradient.
+// needs_r is false when the kernel only uses |r|^2, callers then skip the sqrt.
+namespace KernelPolicies {
+    using SimdKernels::KernelConstants;
+    using SimdKernels::Shape;
+    using SimdKernels::NONE;
+    using SimdKernels::POLY6;
+    using SimdKernels::SPIKY;
+    using SimdKernels::VISCOSITY;
+
+    // one pair per lane, one lane
+    struct Scalar {
+        using F = float;
+        using M = bool;
+        using I = int;
+        static constexpr int width = 1;
+
+        static F set(float v) { return v; }
+
+        static F zero() { return 0.f; }
+
+        static F add(F a, F b) { return a + b; }
+
+        static F sub(F a, F b) { return a - b; }
+
+        static F mul(F a, F b) { return a * b; }
+
+        static F div(F a, F b) { return a / b; }
+
+        static F sqrt(F a) { return std::sqrt(a); }
+
+        static M lt(F a, F b) { return a < b; }
+
+        static M both(M a, M b) { return a && b; }
+
+        static F select(M m, F a, F b) { return m ? a : b; }
+
+        static M lanes(int n) { return n > 0; }
+
+        static I indices(const int *idx, M m) { return m ? *idx : 0; }
+
+        static F gather(const float *base, I i, M m, F fallback) { return m ? base[i] : fallback; }
+
+        static float sum(F a) { return a; }
+    };
+
+    // disabled term
+    template<class S>
+    struct Off {
+        using F = typename S::F;
+        static constexpr bool enabled = false;
+        static constexpr bool needs_r = false;
+
+        Off(const KernelConstants &, Shape) {}
+
+        bool active() const { return false; }
+
+        F value(F, F) const { return S::zero(); }
+
+        F gradient(F, F) const { return S::zero(); }
+
+        F laplacian(F, F) const { return S::zero(); }
+    };
+
+    template<class S>
+    struct Poly6 {
+        using F = typename S::F;
+        static constexpr bool enabled = true;
+        static constexpr bool needs_r = false;
+        F h2, scale, scale_d, scale_dd;
+
+        Poly6(const KernelConstants &c, Shape) :
+                h2(S::set(c.h2)), scale(S::set(c.poly6)), scale_d(S::set(c.poly6_d)), scale_dd(S::set(c.poly6_dd)) {}
+
+        bool active() const { return true; }
+
+        // 315 / ( 64 * PI * h^9 ) * (h^2 - |r|^2)^3
+        F value(F r2, F) const {
+            F sub = S::sub(h2, r2);
+            return S::mul(scale, S::mul(sub, S::mul(sub, sub)));
+        }
+
+        // r * (-945/ (32 * pi * h^9)) * (h^2 - |r|^2)^2
+        F gradient(F r2, F) const {
+            F sub = S::sub(h2, r2);
+            return S::mul(scale_d, S::mul(sub, sub));
+        }
+
+        // (945/ (8 * pi * h^9)) * (h^2 - |r|^2) * ( |r|^2 - 3/4 * (h^2 - |r|^2))
+        F laplacian(F r2, F) const {
+            F sub = S::sub(h2, r2);
+            return S::mul(scale_dd, S::mul(sub, S::sub(r2, S::mul(S::set(0.75f), sub))));
+        }
+    };
+
+    template<class S>
+    struct Spiky {
+        using F = typename S::F;
+        static constexpr bool enabled = true;
+        static constexpr bool needs_r = true;
+        F h, eps, scale, scale_d, scale_dd;
+
+        Spiky(const KernelConstants &c, Shape) :
+                h(S::set(c.h)), eps(S::set(1.1920929e-07f)),
+                scale(S::set(c.spiky)), scale_d(S::set(c.spiky_d)), scale_dd(S::set(c.spiky_dd)) {}
+
+        bool active() const { return true; }
+
+        // 15 / (pi * h^6) * (h - |r|) ^ 3
+        F value(F, F r) const {
+            F sub = S::sub(h, r);
+            return S::mul(scale, S::mul(sub, S::mul(sub, sub)));
+        }
+
+        // -r * (45 / pi * h^6 * |r|) * (h - |r|)^2
+        F gradient(F, F r) const {
+            F sub = S::sub(h, r);
+            F g = S::mul(S::div(scale_d, r), S::mul(sub, sub));
+            return S::select(S::lt(r, eps), S::zero(), g);
+        }
+
+        // - 90 / (pi * h ^ 6 * |r|) * (h - |r|)* (h - 2 * |r|)
+        F laplacian(F, F r) const {
+            F l = S::mul(S::div(scale_dd, r), S::mul(S::sub(h, r), S::sub(h, S::add(r, r))));
+            return S::select(S::lt(r, eps), S::zero(), l);
+        }
+    };
+
+    template<class S>
+    struct Viscosity {
+        using F = typename S::F;
+        static constexpr bool enabled = true;
+        static constexpr bool needs_r = true;
+        F h, eps, scale, scale_d, scale_dd, d_r, d_const, d_r3;
+
+        Viscosity(const KernelConstants &c, Shape) :
+                h(S::set(c.h)), eps(S::set(1.1920929e-07f)),
+                scale(S::set(c.viscosity)), scale_d(S::set(c.viscosity_d)), scale_dd(S::set(c.viscosity_dd)),
+                d_r(S::set(-3.f / (2 * c.h * c.h * c.h))), d_const(S::set(2.f / (c.h * c.h))), d_r3(S::set(c.h / 2)) {}
+
+        bool active() const { return true; }
+
+        // 15 / (2 * pi * h ^ 3) * ( - |r|^3 / 2h^3 + |r| ^ 2 / h ^ 2 + h / (2 * |r|) - 1)
+        F value(F, F r) const {
+            F q = S::div(r, h);
+            F q2 = S::mul(q, q);
+            F poly = S::add(S::mul(S::set(-0.5f), S::mul(q2, q)), q2);
+            poly = S::add(poly, S::sub(S::div(S::set(0.5f), q), S::set(1.f)));
+            return S::mul(scale, poly);
+        }
+
+        // r * 15 / (2 * pi * h ^ 3) * ( - 3 * |r| / (2 * h^3) + 2 / h ^ 2 - h / (2 * |r|^3))
+        F gradient(F r2, F r) const {
+            F g = S::add(S::mul(d_r, r), d_const);
+            g = S::sub(g, S::div(d_r3, S::mul(r2, r)));
+            g = S::mul(scale_d, g);
+            return S::select(S::lt(r, eps), S::zero(), g);
+        }
+
+        // 45 / (pi * h^6) * (h - |r|)
+        F laplacian(F, F r) const {
+            return S::mul(scale_dd, S::sub(h, r));
+        }
+    };
+
+    // shape picked at runtime, for combinations without their own instantiation
+    template<class S>
+    struct Dynamic {
+        using F = typename S::F;
+        static constexpr bool enabled = true;
+        static constexpr bool needs_r = true;
+        Shape shape;
+        Poly6<S> poly6;
+        Spiky<S> spiky;
+        Viscosity<S> viscosity;
+
+        Dynamic(const KernelConstants &c, Shape s) : shape(s), poly6(c, s), spiky(c, s), viscosity(c, s) {}
+
+        bool active() const { return shape != NONE; }
+
+        F value(F r2, F r) const {
+            switch (shape) {
+                case POLY6:
+                    return poly6.value(r2, r);
+                case SPIKY:
+                    return spiky.value(r2, r);
+                case VISCOSITY:
+                    return viscosity.value(r2, r);
+                default:
+                    return S::zero();
+            }
+        }
+
+        F gradient(F r2, F r) const {
+            switch (shape) {
+                case POLY6:
+                    return poly6.gradient(r2, r);
+                case SPIKY:
+                    return spiky.gradient(r2, r);
+                case VISCOSITY:
+                    return viscosity.gradient(r2, r);
+                default:
+                    return S::zero();
+            }
+        }
+
+        F laplacian(F r2, F r) const {
+            switch (shape) {
+                case POLY6:
+                    return poly6.laplacian(r2, r);
+                case SPIKY:
+                    return spiky.laplacian(r2, r);
+                case VISCOSITY:
+                    return viscosity.laplacian(r2, r);
+                default:
+                    return S::zero();
+            }
+        }
+    };
+}
+
+#endif //CFD_2D_KERNEL_POLICIES_H
@@ -6,10 +6,12 @@
 #define CFD_2D_LINE_BOUNDARY_H
 
 #include "Fluid2D.h"
-#include "GLRenderable.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 // a line boundary between start and end
-class LineBoundary final : public BoundaryI, public GLRenderableI {
+class LineBoundary final : public BoundaryI {
 private:
     vec2 u_start;
     vec2 u_end;
@@ -18,6 +20,20 @@ private:
     vec2 normal;
     vec2 direction;
     float damp;
+
+    // 1 if the box is above the line by more than margin, -1 if below, otherwise 0
+    float side(vec2 lower, vec2 upper, float margin) {
+        bool below = true, above = true;
+        for (float x : {lower.x(), upper.x()}) {
+            for (float y : {lower.y(), upper.y()}) {
+                float d = normal.x() * (x - start.x()) + normal.y() * (y - start.y());
+                below = below && d < -margin;
+                above = above && d > margin;
+            }
+        }
+        return above ? 1.f : (below ? -1.f : 0.f);
+    }
+
 public:
     // in a uniform CS [0, 1] x [0, 1], with damp d
     explicit LineBoundary(float start_x, float start_y, float end_x, float end_y, float d = 0)
@@ -35,12 +51,8 @@ public:
         direction = direction.normalize();
     }
 
-    bool updateAt(int index, Vec<D2> next_pos,
-                  std::vector<Vec<D2>> &all_pos,
-                  std::vector<Vec<D2>> &all_vel) override {
+    bool updateAt(vec2 prev_pos, vec2 next_pos, vec2 &vel) override {
         // check if the line (start, end) and (next pos, prev pos) is collided
-        vec2 prev_pos = all_pos[index];
-        vec2 vel = all_vel[index];
         vec2 prev_next = prev_pos - next_pos;
         vec2 start_prev = prev_pos - start;
         vec2 start_next = next_pos - start;
@@ -49,8 +61,8 @@ public:
                 (direction.Mul(end_prev) * direction.Mul(start_prev) <= 0)) {
             float mod = (2 - damp) * vel.Mul(normal);
             vec2 dv = normal * mod;
-            all_vel[index] = vel - dv;
-            all_vel[index] = all_vel[index] * (1 - damp);
+            vel = vel - dv;
+            vel = vel * (1 - damp);
             return true;
         }
 
@@ -63,8 +75,8 @@ public:
                 // and then update velocity, bounce back!
                 float mod =(2 - damp) * vel.Mul(normal);
                 vec2 dv = normal * mod;
-                all_vel[index] = vel - dv;
-                all_vel[index] = all_vel[index] * (1 - damp);
+                vel = vel - dv;
+                vel = vel * (1 - damp);
                 return true;
             }
         }
@@ -76,7 +88,15 @@ public:
         vec2 start_a = a - start;
         vec2 start_b = b - start;
         vec2 a_b = b - a;
-        if (normal.Mul(start_a) * normal.Mul(start_b) <= 0) {
+        float side_a = normal.Mul(start_a), side_b = normal.Mul(start_b);
+        if (side_a == 0 && side_b == 0) {
+            // both on the line, separated only if (a, b) touches the segment
+            vec2 end_start = end - start;
+            float t_a = direction.Mul(start_a), t_b = direction.Mul(start_b);
+            float t_end = direction.Mul(end_start);
+            return std::max(t_a, t_b) >= std::min(0.f, t_end) && std::min(t_a, t_b) <= std::max(0.f, t_end);
+        }
+        if (side_a * side_b <= 0) {
             vec2 end_b = b - end;
             vec2 n(a_b.y(), - a_b.x());
             // are on two side
@@ -85,14 +105,57 @@ public:
         return false;
     }
 
-    // draw the line
-    void update() override {
-        glColor3f(0.8, 0.5, 0.1);
-        glLineWidth(10);
-        glBegin(GL_LINES);
-        glVertex3f(u_start.x() * 2 - 1, u_start.y() * 2 - 1, 0);
-        glVertex3f(u_end.x() * 2 - 1, u_end.y() * 2 - 1, 0);
-        glEnd();
+    bool bounds(vec2 &lower, vec2 &upper) override {
+        lower = vec2(std::min(start.x(), end.x()), std::min(start.y(), end.y()));
+        upper = vec2(std::max(start.x(), end.x()), std::max(start.y(), end.y()));
+        return true;
+    }
+
+    bool overlaps(vec2 lower, vec2 upper) override {
+        vec2 l, u;
+        bounds(l, u);
+        if (u.x() < lower.x() || l.x() > upper.x() || u.y() < lower.y() || l.y() > upper.y()) {
+            return false;
+        }
+        // the line crosses the box unless all corners are on one side
+        return side(lower, upper, 0) == 0;
+    }
+
+    bool blocks(vec2 lower_a, vec2 upper_a, vec2 lower_b, vec2 upper_b) override {
+        // the boxes lie on two sides of the line, clear of it by a margin
+        float margin = 1e-3f * std::max(upper_a.x() - lower_a.x(), upper_a.y() - lower_a.y());
+        float side_a = side(lower_a, upper_a, margin);
+        float side_b = side(lower_b, upper_b, margin);
+        if (side_a * side_b >= 0) {
+            return false;
+        }
+        // and the segment covers the line across both boxes
+        vec2 lower(std::min(lower_a.x(), lower_b.x()), std::min(lower_a.y(), lower_b.y()));
+        vec2 upper(std::max(upper_a.x(), upper_b.x()), std::max(upper_a.y(), upper_b.y()));
+        float corner_min = std::numeric_limits<float>::max(), corner_max = -corner_min;
+        for (float x : {lower.x(), upper.x()}) {
+            for (float y : {lower.y(), upper.y()}) {
+                float t = direction.x() * x + direction.y() * y;
+                corner_min = std::min(corner_min, t);
+                corner_max = std::max(corner_max, t);
+            }
+        }
+        float t_start = direction.x() * start.x() + direction.y() * start.y();
+        float t_end = direction.x() * end.x() + direction.y() * end.y();
+        return std::min(t_start, t_end) < corner_min - margin && std::max(t_start, t_end) > corner_max + margin;
+    }
+
+    // end points in the uniform CS
+    vec2 uniformStart() const {
+        return u_start;
+    }
+
+    vec2 uniformEnd() const {
+        return u_end;
+    }
+
+    float damping() const {
+        return damp;
     }
 };
 
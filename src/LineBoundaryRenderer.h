@@ -0,0 +1,31 @@
+//
+// Created by ZhangHao on 2022/12/4.
+//
+
+#ifndef CFD_2D_LINE_BOUNDARY_RENDERER_H
+#define CFD_2D_LINE_BOUNDARY_RENDERER_H
+
+#include "GLRenderable.h"
+#include "LineBoundary.h"
+
+// draw a line boundary in the viewer
+class LineBoundaryRenderer final : public GLRenderableI {
+private:
+    std::shared_ptr<LineBoundary> line;
+public:
+    explicit LineBoundaryRenderer(std::shared_ptr<LineBoundary> l) : line(std::move(l)) {}
+
+    // draw the line
+    void update() override {
+        vec2 u_start = line->uniformStart();
+        vec2 u_end = line->uniformEnd();
+        glColor3f(0.8, 0.5, 0.1);
+        glLineWidth(10);
+        glBegin(GL_LINES);
+        glVertex3f(u_start.x() * 2 - 1, u_start.y() * 2 - 1, 0);
+        glVertex3f(u_end.x() * 2 - 1, u_end.y() * 2 - 1, 0);
+        glEnd();
+    }
+};
+
+#endif //CFD_2D_LINE_BOUNDARY_RENDERER_H
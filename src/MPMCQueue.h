@@ -0,0 +1,107 @@
+//
+// Created by ZhangHao on 2022/12/13.
+//
+
+#ifndef CFD_2D_MPMC_QUEUE_H
+#define CFD_2D_MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace nano_std {
+
+    // bounded multi producer, multi consumer FIFO without locks.
+    // Every cell carries a sequence number telling whose turn it is: a producer
+    // may fill cell i of round r when its sequence is r * capacity + i, a consumer
+    // may empty it when it is one more. Producers and consumers claim positions
+    // with a CAS on their own counter and never touch the other side's counter.
+    // Capacity is rounded up to a power of two
+    template<typename T>
+    class MPMCQueue {
+    public:
+        explicit MPMCQueue(size_t min_capacity = 1024) {
+            size_t capacity = 2;
+            while (capacity < min_capacity) {
+                capacity *= 2;
+            }
+            mask = capacity - 1;
+            cells = std::make_unique<Cell[]>(capacity);
+            for (size_t i = 0; i < capacity; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MPMCQueue(const MPMCQueue &) = delete;
+
+        MPMCQueue &operator=(const MPMCQueue &) = delete;
+
+        // false if the queue is full
+        bool try_push(T &&value) {
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            for (;;) {
+                Cell &cell = cells[pos & mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                auto turn = static_cast<std::ptrdiff_t>(sequence - pos);
+                if (turn == 0) {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.value = std::move(value);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (turn < 0) {
+                    // the consumer of the previous round has not emptied the cell yet
+                    return false;
+                } else {
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // false if the queue is empty
+        bool try_pop(T &value) {
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            for (;;) {
+                Cell &cell = cells[pos & mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                auto turn = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+                if (turn == 0) {
+                    if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        value = std::move(cell.value);
+                        cell.value = T();
+                        cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (turn < 0) {
+                    // the producer of this round has not filled the cell yet
+                    return false;
+                } else {
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // a hint, pushes and pops in flight may not be counted yet
+        bool empty() const {
+            return dequeue_pos.load(std::memory_order_seq_cst) >= enqueue_pos.load(std::memory_order_seq_cst);
+        }
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        size_t mask;
+        std::unique_ptr<Cell[]> cells;
+        // the two counters on their own cache lines, producers and consumers don't share one
+        alignas(64) std::atomic<size_t> enqueue_pos{0};
+        alignas(64) std::atomic<size_t> dequeue_pos{0};
+    };
+}
+
+#endif //CFD_2D_MPMC_QUEUE_H
@@ -0,0 +1,66 @@
+//
+// Created by ZhangHao on 2022/12/16.
+//
+
+#include "MappedFile.h"
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CFD_2D_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace nano_std {
+
+    bool MappedFile::open(const std::string &path) {
+        close();
+#ifdef CFD_2D_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st{};
+        void *view = MAP_FAILED;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            view = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        // the mapping keeps the file alive
+        ::close(fd);
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        bytes = static_cast<const char *>(view);
+        length = size_t(st.st_size);
+        mapped = true;
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (contents.empty()) {
+            return false;
+        }
+        bytes = contents.data();
+        length = contents.size();
+#endif
+        return true;
+    }
+
+    void MappedFile::close() {
+#ifdef CFD_2D_MMAP
+        if (mapped) {
+            ::munmap(const_cast<char *>(bytes), length);
+        }
+#endif
+        contents.clear();
+        contents.shrink_to_fit();
+        bytes = nullptr;
+        length = 0;
+        mapped = false;
+    }
+}
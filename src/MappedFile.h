@@ -0,0 +1,53 @@
+//
+// Created by ZhangHao on 2022/12/16.
+//
+
+#ifndef CFD_2D_MAPPED_FILE_H
+#define CFD_2D_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace nano_std {
+
+    // a whole file, read only. Mapped into memory where the platform allows it, so pages
+    // are only read when touched, otherwise read into a buffer
+    class MappedFile {
+    public:
+        MappedFile() = default;
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        ~MappedFile() {
+            close();
+        }
+
+        // false if the file can't be opened or is empty
+        bool open(const std::string &path);
+
+        void close();
+
+        const char *data() const {
+            return bytes;
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+        bool isOpen() const {
+            return bytes != nullptr;
+        }
+
+    private:
+        const char *bytes{nullptr};
+        size_t length{0};
+        bool mapped{false};
+        std::vector<char> contents;
+    };
+}
+
+#endif //CFD_2D_MAPPED_FILE_H
@@ -0,0 +1,111 @@
+//
+// Created by ZhangHao on 2022/12/9.
+//
+
+#include "NeighbourList.h"
+#include <algorithm>
+#include <cmath>
+
+// particles handled by one task at least
+static const int min_chunk_size = 1024;
+
+void NeighbourList::build(const CellGrid &grid, const float *x, const float *y, int count,
+                          float h, float s, bool forward_only, nano_std::ThreadPool *pool) {
+    skin = s;
+    forward = forward_only;
+    float radius = h + skin;
+    float radius_2 = radius * radius;
+    // cells of size h, so a radius of h + skin may reach past the 3 x 3 block
+    int reach = std::max(1, int(std::ceil(radius / h)));
+    cell_reach = reach;
+    int chunks = std::max(1, std::min(int(pool->size()), count / min_chunk_size));
+    int chunk_size = (count + chunks - 1) / chunks;
+
+    auto for_each_candidate = [&](int i, auto &&visit) {
+        int cell = grid.cellOf(i);
+        if (cell < 0) {
+            return;
+        }
+        int cell_x, cell_y;
+        grid.cellCoords(cell, cell_x, cell_y);
+        float px = x[i], py = y[i];
+        grid.forEachNeighbour(cell_x, cell_y, [&](int other) {
+            if (forward_only) {
+                int other_cell = grid.cellOf(other);
+                if (other_cell < cell || (other_cell == cell && other <= i)) {
+                    return;
+                }
+            }
+            float dx = px - x[other];
+            float dy = py - y[other];
+            if (dx * dx + dy * dy <= radius_2) {
+                visit(other);
+            }
+        }, reach);
+    };
+
+    // 1. count neighbours, offsets within the chunk
+    start.resize(count + 1);
+    chunk_offset.resize(chunks + 1);
+    pool->syncChunks(chunks, [&](int t) {
+        int end = std::min(count, (t + 1) * chunk_size);
+        int sum = 0;
+        for (int i = t * chunk_size; i < end; i++) {
+            int n = 0;
+            for_each_candidate(i, [&n](int) { n++; });
+            sum += n;
+            start[i + 1] = sum;
+        }
+        chunk_offset[t + 1] = sum;
+    });
+    // then shifted by the chunks before
+    chunk_offset[0] = 0;
+    for (int t = 0; t < chunks; t++) {
+        chunk_offset[t + 1] += chunk_offset[t];
+    }
+    start[0] = 0;
+    pool->syncChunks(chunks, [&](int t) {
+        int end = std::min(count, (t + 1) * chunk_size);
+        for (int i = t * chunk_size; i < end; i++) {
+            start[i + 1] += chunk_offset[t];
+        }
+    });
+
+    // 2. fill the lists
+    list.resize(start[count]);
+    ref_x.resize(count);
+    ref_y.resize(count);
+    pool->syncChunks(chunks, [&](int t) {
+        int end = std::min(count, (t + 1) * chunk_size);
+        for (int i = t * chunk_size; i < end; i++) {
+            int *out = list.data() + start[i];
+            for_each_candidate(i, [&out](int other) { *out++ = other; });
+            ref_x[i] = x[i];
+            ref_y[i] = y[i];
+        }
+    });
+    valid = true;
+    build_count++;
+}
+
+bool NeighbourList::needsRebuild(const float *x, const float *y, int count, nano_std::ThreadPool *pool) {
+    if (!valid || int(ref_x.size()) != count) {
+        return true;
+    }
+    int chunks = std::max(1, std::min(int(pool->size()), count / min_chunk_size));
+    int chunk_size = (count + chunks - 1) / chunks;
+    chunk_max.resize(chunks);
+    pool->syncChunks(chunks, [&](int t) {
+        float max_2 = 0;
+        int end = std::min(count, (t + 1) * chunk_size);
+        for (int i = t * chunk_size; i < end; i++) {
+            float dx = x[i] - ref_x[i];
+            float dy = y[i] - ref_y[i];
+            max_2 = std::max(max_2, dx * dx + dy * dy);
+        }
+        chunk_max[t] = max_2;
+    });
+    float max_2 = *std::max_element(chunk_max.begin(), chunk_max.end());
+    float half_skin = skin / 2;
+    return max_2 > half_skin * half_skin;
+}
@@ -0,0 +1,76 @@
+//
+// Created by ZhangHao on 2022/12/9.
+//
+
+#ifndef CFD_2D_NEIGHBOUR_LIST_H
+#define CFD_2D_NEIGHBOUR_LIST_H
+
+#include "CellGrid.h"
+#include "Particles.h"
+
+// Verlet neighbour lists in CSR form: the neighbours of particle i, itself
+// included, are list[start[i]] ... list[start[i + 1] - 1].
+// Lists are built with radius h + skin and stay valid until a particle has
+// moved more than skin / 2 since the build.
+// Forward lists hold every pair once, see CellGrid::forEachForwardNeighbour.
+class NeighbourList {
+public:
+    // build the lists of count particles from an indexed grid with cell size h
+    void build(const CellGrid &grid, const float *x, const float *y, int count,
+               float h, float skin, bool forward_only, nano_std::ThreadPool *pool);
+
+    // true if the lists were never built, or some particle moved more than skin / 2
+    bool needsRebuild(const float *x, const float *y, int count, nano_std::ThreadPool *pool);
+
+    // force the next needsRebuild to return true
+    void invalidate() {
+        valid = false;
+    }
+
+    inline CellGrid::Range neighbours(int particle) const {
+        return CellGrid::Range{list.data() + start[particle], list.data() + start[particle + 1]};
+    }
+
+    bool isForward() const {
+        return forward;
+    }
+
+    // grid rows covered by the lists around a particle
+    int reach() const {
+        return cell_reach;
+    }
+
+    // positions of the last build, nullptr while the lists are invalid
+    const float *builtX() const {
+        return valid ? ref_x.data() : nullptr;
+    }
+
+    const float *builtY() const {
+        return valid ? ref_y.data() : nullptr;
+    }
+
+    // how many times the lists have been built
+    unsigned long rebuilds() const {
+        return build_count;
+    }
+
+private:
+    bool valid{false};
+    bool forward{false};
+    int cell_reach{1};
+    float skin{0};
+    unsigned long build_count{0};
+    // CSR offsets, size count + 1
+    std::vector<int> start;
+    // neighbour indices of all particles
+    std::vector<int> list;
+    // positions at the last build
+    nano_std::aligned_vector<float> ref_x;
+    nano_std::aligned_vector<float> ref_y;
+    // per chunk maximum displacement
+    std::vector<float> chunk_max;
+    // per chunk neighbour count, then its offset in list
+    std::vector<int> chunk_offset;
+};
+
+#endif //CFD_2D_NEIGHBOUR_LIST_H
@@ -0,0 +1,104 @@
+//
+// Created by ZhangHao on 2022/12/6.
+//
+
+#ifndef CFD_2D_PARTICLES_H
+#define CFD_2D_PARTICLES_H
+
+#include "Vec.h"
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace nano_std {
+
+    // allocator with over-aligned storage, so every array starts on a cache line
+    template<typename T, std::size_t Align = 64>
+    struct AlignedAllocator {
+        using value_type = T;
+
+        template<typename U>
+        struct rebind {
+            using other = AlignedAllocator<U, Align>;
+        };
+
+        AlignedAllocator() noexcept = default;
+
+        template<typename U>
+        AlignedAllocator(const AlignedAllocator<U, Align> &) noexcept {}
+
+        T *allocate(std::size_t n) {
+            return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+        }
+
+        void deallocate(T *p, std::size_t) noexcept {
+            ::operator delete(p, std::align_val_t(Align));
+        }
+
+        template<typename U>
+        bool operator==(const AlignedAllocator<U, Align> &) const noexcept { return true; }
+
+        template<typename U>
+        bool operator!=(const AlignedAllocator<U, Align> &) const noexcept { return false; }
+    };
+
+    template<typename T>
+    using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+}
+
+// positions of one finished step, handed from the solver to its consumer
+struct PositionFrame {
+    nano_std::aligned_vector<float> x;
+    nano_std::aligned_vector<float> y;
+    // steps since the solver was initialized
+    unsigned long step{0};
+    // external id of the particle at each index, read only when reordered is set.
+    // Sized once with x and y, the solver copies new ids in after a reorder
+    std::vector<unsigned int> ids;
+    bool reordered{false};
+    // ids version of the solver the frame holds
+    unsigned long ids_version{0};
+
+    unsigned int id(std::size_t i) const {
+        return reordered ? ids[i] : static_cast<unsigned int>(i);
+    }
+};
+
+// structure of arrays particle storage, each attribute is one contiguous array
+struct ParticleSoA {
+    // position, views of the newest PositionFrame, set by the solver
+    float *x{nullptr};
+    float *y{nullptr};
+    // velocity
+    nano_std::aligned_vector<float> vx;
+    nano_std::aligned_vector<float> vy;
+    // acceleration
+    nano_std::aligned_vector<float> ax;
+    nano_std::aligned_vector<float> ay;
+    // density
+    nano_std::aligned_vector<float> rho;
+    // pressure
+    nano_std::aligned_vector<float> p;
+    // 1 / density, written together with the pressure
+    nano_std::aligned_vector<float> inv_rho;
+
+    void resize(std::size_t n) {
+        for (auto *array : {&vx, &vy, &ax, &ay, &rho, &p, &inv_rho}) {
+            array->assign(n, 0.f);
+        }
+    }
+
+    std::size_t size() const {
+        return vx.size();
+    }
+
+    vec2 position(std::size_t i) const {
+        return vec2(x[i], y[i]);
+    }
+
+    vec2 velocity(std::size_t i) const {
+        return vec2(vx[i], vy[i]);
+    }
+};
+
+#endif //CFD_2D_PARTICLES_H
@@ -0,0 +1,82 @@
+//
+// Created by ZhangHao on 2022/12/17.
+//
+
+#include "ReplayRenderer.h"
+#include <algorithm>
+
+static const double min_speed = 1.0 / 8;
+static const double max_speed = 64;
+
+bool ReplayRenderer::open(const std::string &path) {
+    last_error.clear();
+    if (!reader.open(path)) {
+        last_error = reader.error();
+        return false;
+    }
+    if (reader.frames() == 0) {
+        last_error = path + " holds no frames";
+        reader.close();
+        return false;
+    }
+    x.assign(reader.particles(), 0);
+    y.assign(reader.particles(), 0);
+    float left, bottom, right, top;
+    reader.domain(left, bottom, right, top);
+    center_x = (left + right) / 2;
+    center_y = (top + bottom) / 2;
+    position = 0;
+    shown = SIZE_MAX;
+    return true;
+}
+
+void ReplayRenderer::update() {
+    if (!reader.isOpen()) {
+        return;
+    }
+    // only a new frame is decoded, playing forward decodes one delta frame per frame
+    size_t target = frame();
+    if (target != shown && reader.read(target, x.data(), y.data())) {
+        shown = target;
+    }
+
+    glScalef(scale, scale, scale);
+    glTranslatef(- center_x, - center_y, 0);
+    glColor3f(0.3, 0.5, 0.8);
+    glPointSize(4);
+    glBegin(GL_POINTS);
+    for (size_t i = 0; i < x.size(); i++) {
+        glVertex3f(x[i], y[i], 0);
+    }
+    glEnd();
+
+    if (!paused) {
+        position += speed;
+        double last = double(reader.frames() - 1);
+        if (position >= last) {
+            // hold the last frame
+            position = last;
+            paused = true;
+        }
+    }
+}
+
+void ReplayRenderer::seek(long frames) {
+    long target = long(frame()) + frames;
+    seekTo(target < 0 ? 0 : size_t(target));
+}
+
+void ReplayRenderer::seekTo(size_t frame) {
+    if (reader.frames() == 0) {
+        return;
+    }
+    position = double(std::min(frame, reader.frames() - 1));
+}
+
+void ReplayRenderer::faster() {
+    speed = std::min(speed * 2, max_speed);
+}
+
+void ReplayRenderer::slower() {
+    speed = std::max(speed / 2, min_speed);
+}
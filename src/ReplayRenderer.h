@@ -0,0 +1,97 @@
+//
+// Created by ZhangHao on 2022/12/17.
+//
+
+#ifndef CFD_2D_REPLAY_RENDERER_H
+#define CFD_2D_REPLAY_RENDERER_H
+
+#include "GLRenderable.h"
+#include "Trajectory.h"
+#include <string>
+#include <vector>
+
+// play a recorded trajectory back, without a solver. The file is mapped, a frame is
+// only decoded when it is shown, so opening and seeking do not depend on the run length
+class ReplayRenderer final : public GLRenderableI {
+public:
+    ReplayRenderer() : position(0), speed(1), paused(false), shown(SIZE_MAX), scale(1) {}
+
+    // map a file written by Trajectory::Writer, false with error() set otherwise
+    bool open(const std::string &path);
+
+    // draw the frame at the play position, then advance it by speed frames
+    void update() final;
+
+    // render scale
+    void setScale(float s) {
+        this->scale = s;
+    }
+
+    void togglePause() {
+        paused = !paused;
+    }
+
+    bool isPaused() const {
+        return paused;
+    }
+
+    // move the play position by frames, clamped to the recording
+    void seek(long frames);
+
+    void seekTo(size_t frame);
+
+    // frames advanced per display refresh, doubled or halved between 1/8 and 64
+    void faster();
+
+    void slower();
+
+    float playSpeed() const {
+        return float(speed);
+    }
+
+    size_t frame() const {
+        return size_t(position);
+    }
+
+    size_t frames() const {
+        return reader.frames();
+    }
+
+    // frames from one key frame to the next, a natural seek distance
+    size_t keyInterval() const {
+        return reader.keyInterval();
+    }
+
+    uint64_t step() const {
+        return reader.step(frame());
+    }
+
+    double time() const {
+        return reader.time(frame());
+    }
+
+    const std::vector<Trajectory::Wall> &walls() const {
+        return reader.walls();
+    }
+
+    const std::string &error() const {
+        return last_error;
+    }
+
+private:
+    Trajectory::Reader reader;
+    // decoded positions of frame shown
+    std::vector<float> x;
+    std::vector<float> y;
+    // play position in frames, fractional below speed 1
+    double position;
+    double speed;
+    bool paused;
+    size_t shown;
+    std::string last_error;
+    // render parameters
+    float scale;
+    float center_x{0}, center_y{0};
+};
+
+#endif //CFD_2D_REPLAY_RENDERER_H
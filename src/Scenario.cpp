@@ -0,0 +1,217 @@
+//
+// Created by ZhangHao on 2022/12/4.
+//
+
+#include "Scenario.h"
+#include "KernelPolicies.h"
+#include <cmath>
+#include <memory>
+
+// default IMPL of Poly6, DebrunSpiky and Viscosity. The solver only reads their kind and
+// evaluates the closed forms at params.h, the functions are a reference at h = 1
+#ifndef KERNEL_WITH_H
+#define KERNEL_WITH_H 1.f
+#include "SmoothKernels.h"
+#endif
+
+// simulation domain, 800 x 800 pixels with 10 pixels per unit
+const float domain_size = 80;
+const float axis_short_size = 8;
+
+// init location of the liquid
+const float init_x = 2;
+const float init_y = 4;
+const float init_w = 2;
+const float init_h = 3;
+
+// particle count of each unit area
+const int p_cnt_per_u = int(16 * 10000 / 10 / 10);
+
+// simulation params
+const float rho_0 = 18;
+const float K = 1;
+const float miu = 0.3;
+const float sigma = 0.05;
+const vec2 G(0, -0.5);
+const float dt = 0.05;
+// smoothing length
+const float h = 1;
+
+static Fluid2D::Fluid2DParameters basic_params() {
+    Fluid2D::Fluid2DParameters params;
+    params.delta_t = dt;
+    params.top = domain_size;
+    params.bottom = 0;
+    params.left = 0;
+    params.right = domain_size;
+    params.rho_0 = rho_0;
+    params.K = K;
+    params.V = miu;
+    params.sigma = sigma;
+    params.particle_count = int(p_cnt_per_u * init_w * init_h);
+    params.gravity = G;
+    params.rho_kernel = &Poly6<D2>();
+    params.pressure_kernel = &DebrunSpiky<D2>();
+    params.viscosity_kernel = &Viscosity<D2>();
+    params.surface_tension_kernel = &Poly6<D2>();
+    params.h = h;
+    params.init_positions = [](std::vector<Vec<D2>> &positions, float t, float b, float l, float r) {
+        float unit_size = std::min((r - l), (t - b)) / axis_short_size;
+        float unit_count = std::sqrt(float(positions.size()) / (init_w * init_h));
+        float step_size = 1.f / unit_count;
+        int width = std::ceil(unit_count * init_w), height = std::ceil(unit_count * init_h);
+        // row by row, so indices below the particle count are all filled
+        for (int dy = 0; dy < height; dy++) {
+            for (int dx = 0; dx < width; dx++) {
+                int index = dy * width + dx;
+                if (index >= positions.size()) return;
+                positions[index].x() = l + unit_size * (float(dx) * step_size + 0.5 * step_size + init_x);
+                positions[index].y() = b + unit_size * (float(dy) * step_size + 0.5 * step_size + init_y);
+            }
+        }
+    };
+    return params;
+}
+
+// a tank with liquid dropping from the top left
+static void dam_break(Scenario &scenario) {
+    scenario.params = basic_params();
+    // walls
+    float i = 1.f / axis_short_size;
+    float damp = 0.1;
+    scenario.walls.push_back(std::make_shared<LineBoundary>(i * 1, 0.0001, i * 1, i * 5, damp));
+    scenario.walls.push_back(std::make_shared<LineBoundary>(i * 6, 0.0001, i * 6, i * 5, damp));
+    scenario.walls.push_back(std::make_shared<LineBoundary>(i * 1, 0.0001, i * 6, 0.0001, damp));
+}
+
+// the dam break tank with the liquid falling through a field of short pegs
+static void pegs(Scenario &scenario) {
+    dam_break(scenario);
+    const int rows = 12, cols = 20;
+    const float peg_size = 0.008;
+    for (int r = 0; r < rows; r++) {
+        float y = 0.08f + 0.03f * float(r);
+        for (int c = 0; c < cols; c++) {
+            // staggered rows, pegs tilted to alternating sides
+            float x = 0.14f + 0.024f * (float(c) + 0.5f * float(r % 2));
+            float tilt = (r + c) % 2 == 0 ? peg_size : -peg_size;
+            scenario.walls.push_back(std::make_shared<LineBoundary>(x - peg_size, y - tilt, x + peg_size, y + tilt, 0.1));
+        }
+    }
+}
+
+bool loadScenario(const std::string &name, Scenario &scenario) {
+    scenario.name = name;
+    scenario.walls.clear();
+    if (name == "dam_break") {
+        dam_break(scenario);
+        return true;
+    }
+    if (name == "pegs") {
+        pegs(scenario);
+        return true;
+    }
+    return false;
+}
+
+std::vector<std::string> scenarioNames() {
+    return {"dam_break", "pegs"};
+}
+
+bool applyPreset(Fluid2D::Fluid2DParameters &params, int preset) {
+    switch (preset) {
+        case 1:
+            params.pressure_kernel = &Poly6<D2>();
+            params.viscosity_kernel = nullptr;
+            params.surface_tension_kernel = nullptr;
+            params.K = 0.2;
+            params.V = 0;
+            params.sigma = 0;
+            return true;
+        case 2:
+            params.pressure_kernel = &DebrunSpiky<D2>();
+            params.viscosity_kernel = nullptr;
+            params.surface_tension_kernel = nullptr;
+            params.K = 0.2;
+            params.V = 0;
+            params.sigma = 0;
+            return true;
+        case 3:
+            params.delta_t = dt;
+            params.pressure_kernel = &DebrunSpiky<D2>();
+            params.viscosity_kernel = &Viscosity<D2>();
+            params.surface_tension_kernel = nullptr;
+            params.K = K;
+            params.V = miu;
+            params.sigma = 0;
+            return true;
+        case 4:
+            params.delta_t = dt;
+            params.pressure_kernel = &DebrunSpiky<D2>();
+            params.viscosity_kernel = &Viscosity<D2>();
+            params.surface_tension_kernel = &Poly6<D2>();
+            params.K = K;
+            params.V = miu;
+            params.sigma = sigma;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// table of a built in kernel, sampled from its policy at h like the solver evaluates it
+template<template<class> class Policy>
+static std::unique_ptr<SmoothKernels::KernelTable<D2>> policy_table(SmoothKernels::SmoothKernel<D2> &kernel,
+                                                                    float h, int resolution) {
+    using P = Policy<KernelPolicies::Scalar>;
+    const P policy(SimdKernels::makeConstants(h), SimdKernels::NONE);
+    return std::make_unique<SmoothKernels::KernelTable<D2>>(
+            kernel, h, resolution, [&policy](float r2, float r, float &w, float &d, float &l) {
+                w = policy.value(r2, r);
+                d = policy.gradient(r2, r);
+                l = policy.laplacian(r2, r);
+                // the policies return 0 where they are singular at r = 0, the table repeats the next sample
+                if (P::needs_r && r2 == 0) {
+                    if (d == 0) d = NAN;
+                    if (l == 0) l = NAN;
+                }
+            });
+}
+
+static std::unique_ptr<SmoothKernels::KernelTable<D2>> make_table(SmoothKernels::SmoothKernel<D2> &kernel,
+                                                                  float h, int resolution) {
+    switch (kernel.kind()) {
+        case SmoothKernels::POLY6:
+            return policy_table<KernelPolicies::Poly6>(kernel, h, resolution);
+        case SmoothKernels::SPIKY:
+            return policy_table<KernelPolicies::Spiky>(kernel, h, resolution);
+        case SmoothKernels::VISCOSITY:
+            return policy_table<KernelPolicies::Viscosity>(kernel, h, resolution);
+        default:
+            return std::make_unique<SmoothKernels::KernelTable<D2>>(kernel, h, resolution);
+    }
+}
+
+void tabulateKernels(Fluid2D::Fluid2DParameters &params, int resolution, KernelTables &tables) {
+    // one table per kernel, rho and surface tension often share theirs
+    std::pair<SmoothKernels::SmoothKernel<D2> *, SmoothKernels::SmoothKernel<D2> *> made[4];
+    int made_count = 0;
+    for (auto *kernel : {&params.rho_kernel, &params.pressure_kernel,
+                         &params.viscosity_kernel, &params.surface_tension_kernel}) {
+        if (*kernel == nullptr || (*kernel)->isTabulated()) {
+            continue;
+        }
+        SmoothKernels::SmoothKernel<D2> *table_kernel = nullptr;
+        for (int i = 0; i < made_count; i++) {
+            if (made[i].first == *kernel) {
+                table_kernel = made[i].second;
+            }
+        }
+        if (table_kernel == nullptr) {
+            tables.push_back(make_table(**kernel, params.h, resolution));
+            table_kernel = &tables.back()->kernel();
+            made[made_count++] = {*kernel, table_kernel};
+        }
+        *kernel = table_kernel;
+    }
+}
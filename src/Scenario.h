@@ -0,0 +1,40 @@
+//
+// Created by ZhangHao on 2022/12/4.
+//
+
+#ifndef CFD_2D_SCENARIO_H
+#define CFD_2D_SCENARIO_H
+
+#include "Fluid2D.h"
+#include "LineBoundary.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// a simulation setup shared by the viewer and the headless runner
+struct Scenario {
+    std::string name;
+    Fluid2D::Fluid2DParameters params;
+    // walls in the uniform CS, see LineBoundary
+    std::vector<std::shared_ptr<LineBoundary>> walls;
+};
+
+// build a scenario by name, return false if the name is unknown
+bool loadScenario(const std::string &name, Scenario &scenario);
+
+// names accepted by loadScenario
+std::vector<std::string> scenarioNames();
+
+// kernel presets switched with the number keys in the viewer, 1 ~ 4
+// return false if the preset is unknown
+bool applyPreset(Fluid2D::Fluid2DParameters &params, int preset);
+
+// kernel tables of a run, they must outlive the solvers using them
+using KernelTables = std::vector<std::unique_ptr<SmoothKernels::KernelTable<D2>>>;
+
+// replace the kernels of params by interpolating tables with resolution + 1 samples,
+// added to tables, see SmoothKernels::KernelTable. Kernels that are tables already are
+// kept. Call it after applyPreset
+void tabulateKernels(Fluid2D::Fluid2DParameters &params, int resolution, KernelTables &tables);
+
+#endif //CFD_2D_SCENARIO_H
@@ -0,0 +1,70 @@
+//
+// Created by ZhangHao on 2022/12/10.
+//
+
+#include "SimdKernelsIMPL.h"
+
+#define PI 3.1415926535f
+
+namespace SimdKernels {
+    KernelConstants makeConstants(float h) {
+        KernelConstants c{};
+        float h3 = h * h * h;
+        float h6 = h3 * h3;
+        float h9 = h6 * h3;
+        c.h = h;
+        c.h2 = h * h;
+        c.poly6 = 315.f / (64.f * PI * h9);
+        c.poly6_d = -945.f / (32.f * PI * h9);
+        c.poly6_dd = 945.f / (8.f * PI * h9);
+        c.spiky = 15 / (PI * h6);
+        c.spiky_d = -45 / (PI * h6);
+        c.spiky_dd = -90 / (PI * h6);
+        c.viscosity = 15 / (2 * PI * h3);
+        c.viscosity_d = 15 / (2 * PI * h3);
+        c.viscosity_dd = 45 / (PI * h6);
+        return c;
+    }
+
+    Backend scalarBackend(const Shapes &shapes) {
+        return makeBackend<KernelPolicies::Scalar>(SCALAR, shapes);
+    }
+
+    ISA detect() {
+#if defined(CFD_2D_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return AVX512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return AVX2;
+        }
+#endif
+        return SCALAR;
+    }
+
+    Backend backend(ISA max_isa, const Shapes &shapes) {
+        static const ISA supported = detect();
+        ISA isa = max_isa < supported ? max_isa : supported;
+#ifdef CFD_2D_SIMD_X86
+        if (isa == AVX512) {
+            return avx512Backend(shapes);
+        }
+        if (isa == AVX2) {
+            return avx2Backend(shapes);
+        }
+#endif
+        return scalarBackend(shapes);
+    }
+
+    const char *isaName(ISA isa) {
+        switch (isa) {
+            case AVX2:
+                return "avx2";
+            case AVX512:
+                return "avx512";
+            default:
+                return "scalar";
+        }
+    }
+}
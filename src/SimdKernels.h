@@ -0,0 +1,115 @@
+//
+// Created by ZhangHao on 2022/12/10.
+//
+
+#ifndef CFD_2D_SIMD_KERNELS_H
+#define CFD_2D_SIMD_KERNELS_H
+
+// Closed form Poly6, Spiky and Viscosity kernels evaluated over a list of
+// neighbours, several neighbours per instruction.
+// Backends are compiled in their own translation units with the matching
+// instruction set flags and picked at runtime, so this header only holds
+// plain data and declarations.
+namespace SimdKernels {
+    enum ISA {
+        // one neighbour at a time, always available
+        SCALAR = 0,
+        // 8 neighbours per instruction
+        AVX2 = 1,
+        // 16 neighbours per instruction
+        AVX512 = 2
+    };
+
+    // kernel shapes, NONE disables the term
+    enum Shape {
+        NONE = 0,
+        POLY6 = 1,
+        SPIKY = 2,
+        VISCOSITY = 3
+    };
+
+    // kernel shapes of a whole evaluation
+    struct Shapes {
+        Shape rho;
+        Shape pressure;
+        Shape viscosity;
+        Shape tension;
+    };
+
+    // scale factors of all kernels for a smoothing length h
+    struct KernelConstants {
+        float h;
+        float h2;
+        float poly6, poly6_d, poly6_dd;
+        float spiky, spiky_d, spiky_dd;
+        float viscosity, viscosity_d, viscosity_dd;
+    };
+
+    KernelConstants makeConstants(float h);
+
+    // density of one particle at (px, py)
+    struct DensityArgs {
+        const float *x;
+        const float *y;
+        float px;
+        float py;
+        float mass;
+        Shape shape;
+        KernelConstants c;
+    };
+
+    // pressure, viscosity and surface tension terms of one particle
+    struct ForceArgs {
+        const float *x;
+        const float *y;
+        const float *vx;
+        const float *vy;
+        // 1 / rho
+        const float *inv_rho;
+        const float *p;
+        float px;
+        float py;
+        float vxi;
+        float vyi;
+        float pi;
+        // viscosity coefficient
+        float V;
+        Shape pressure;
+        Shape viscosity;
+        Shape tension;
+        KernelConstants c;
+    };
+
+    // summed acceleration, kappa is sum(- laplace_W / rho_j) of the surface tension
+    struct ForceSum {
+        float ax;
+        float ay;
+        float kappa;
+    };
+
+    // neighbours are idx[0] ... idx[n - 1]
+    using DensityFunction = float (*)(const DensityArgs &args, const int *idx, int n);
+    using ForceFunction = ForceSum (*)(const ForceArgs &args, const int *idx, int n);
+
+    struct Backend {
+        ISA isa;
+        DensityFunction density;
+        ForceFunction force;
+    };
+
+    // best instruction set supported by this CPU and build
+    ISA detect();
+
+    // backend of the best instruction set up to max_isa, with the kernel loops
+    // specialised for shapes when they are one of the presets
+    Backend backend(ISA max_isa, const Shapes &shapes);
+
+    const char *isaName(ISA isa);
+
+    // implemented in the instruction set specific translation units
+    Backend scalarBackend(const Shapes &shapes);
+    Backend avx2Backend(const Shapes &shapes);
+    Backend avx512Backend(const Shapes &shapes);
+}
+
+#endif //CFD_2D_SIMD_KERNELS_H
@@ -0,0 +1,66 @@
+//
+// Created by ZhangHao on 2022/12/10.
+//
+// compiled with -mavx2 -mfma, only called when the CPU supports AVX2
+
+#include <immintrin.h>
+
+namespace {
+    // 8 neighbours per lane
+    struct Avx2 {
+        using F = __m256;
+        using M = __m256;
+        using I = __m256i;
+        static constexpr int width = 8;
+
+        static F set(float v) { return _mm256_set1_ps(v); }
+
+        static F zero() { return _mm256_setzero_ps(); }
+
+        static F add(F a, F b) { return _mm256_add_ps(a, b); }
+
+        static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+
+        static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+
+        static F div(F a, F b) { return _mm256_div_ps(a, b); }
+
+        static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+
+        static M lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+
+        static M both(M a, M b) { return _mm256_and_ps(a, b); }
+
+        static F select(M m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+
+        // lanes 0 ... n - 1 active
+        static M lanes(int n) {
+            I lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            return _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane));
+        }
+
+        // masked load, never reads past the active lanes
+        static I indices(const int *idx, M m) {
+            return _mm256_maskload_epi32(idx, _mm256_castps_si256(m));
+        }
+
+        static F gather(const float *base, I i, M m, F fallback) {
+            return _mm256_mask_i32gather_ps(fallback, base, i, m, 4);
+        }
+
+        static float sum(F a) {
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            s = _mm_add_ss(s, _mm_movehdup_ps(s));
+            return _mm_cvtss_f32(s);
+        }
+    };
+}
+
+#include "SimdKernelsIMPL.h"
+
+namespace SimdKernels {
+    Backend avx2Backend(const Shapes &shapes) {
+        return makeBackend<Avx2>(AVX2, shapes);
+    }
+}
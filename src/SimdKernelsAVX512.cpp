@@ -0,0 +1,62 @@
+//
+// Created by ZhangHao on 2022/12/10.
+//
+// compiled with -mavx512f, only called when the CPU supports AVX-512F
+
+#include <immintrin.h>
+
+namespace {
+    // 16 neighbours per lane
+    struct Avx512 {
+        using F = __m512;
+        using M = __mmask16;
+        using I = __m512i;
+        static constexpr int width = 16;
+
+        static F set(float v) { return _mm512_set1_ps(v); }
+
+        static F zero() { return _mm512_setzero_ps(); }
+
+        static F add(F a, F b) { return _mm512_add_ps(a, b); }
+
+        static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+
+        static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+
+        static F div(F a, F b) { return _mm512_div_ps(a, b); }
+
+        static F sqrt(F a) { return _mm512_sqrt_ps(a); }
+
+        static M lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+
+        static M both(M a, M b) { return M(a & b); }
+
+        static F select(M m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+
+        // lanes 0 ... n - 1 active
+        static M lanes(int n) {
+            return n >= width ? M(0xFFFF) : M((1u << n) - 1);
+        }
+
+        // masked load, never reads past the active lanes
+        static I indices(const int *idx, M m) {
+            return _mm512_maskz_loadu_epi32(m, idx);
+        }
+
+        static F gather(const float *base, I i, M m, F fallback) {
+            return _mm512_mask_i32gather_ps(fallback, m, i, base, 4);
+        }
+
+        static float sum(F a) {
+            return _mm512_reduce_add_ps(a);
+        }
+    };
+}
+
+#include "SimdKernelsIMPL.h"
+
+namespace SimdKernels {
+    Backend avx512Backend(const Shapes &shapes) {
+        return makeBackend<Avx512>(AVX512, shapes);
+    }
+}
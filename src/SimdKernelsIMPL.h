@@ -0,0 +1,107 @@
+//
+// Created by ZhangHao on 2022/12/10.
+//
+
+// Density and force loops shared by all SimdKernels backends, written once against
+// a lane type S (see KernelPolicies.h) and templated on one kernel policy per term.
+// Everything lives in an anonymous namespace, every backend translation unit
+// gets its own copy compiled with its own instruction set.
+// Include only from a backend translation unit, after defining S.
+
+#include "KernelPolicies.h"
+#include "SimdKernels.h"
+
+namespace {
+    using namespace SimdKernels;
+    using namespace KernelPolicies;
+
+    template<class S, class Rho>
+    float density(const DensityArgs &a, const int *idx, int n) {
+        using F = typename S::F;
+        using M = typename S::M;
+        const Rho kernel(a.c, a.shape);
+        F px = S::set(a.px), py = S::set(a.py), h2 = S::set(a.c.h2);
+        F sum = S::zero();
+        for (int k = 0; k < n; k += S::width) {
+            M m = S::lanes(n - k);
+            auto vi = S::indices(idx + k, m);
+            F dx = S::sub(px, S::gather(a.x, vi, m, S::zero()));
+            F dy = S::sub(py, S::gather(a.y, vi, m, S::zero()));
+            F r2 = S::add(S::mul(dx, dx), S::mul(dy, dy));
+            M active = S::both(m, S::lt(r2, h2));
+            F w = kernel.value(r2, Rho::needs_r ? S::sqrt(r2) : r2);
+            sum = S::add(sum, S::select(active, w, S::zero()));
+        }
+        return a.mass * S::sum(sum);
+    }
+
+    template<class S, class Pressure, class Viscous, class Tension>
+    ForceSum force(const ForceArgs &a, const int *idx, int n) {
+        using F = typename S::F;
+        using M = typename S::M;
+        constexpr bool needs_r = Pressure::needs_r || Viscous::needs_r || Tension::needs_r;
+        const Pressure pressure(a.c, a.pressure);
+        const Viscous viscous(a.c, a.viscosity);
+        const Tension tension(a.c, a.tension);
+        F px = S::set(a.px), py = S::set(a.py), h2 = S::set(a.c.h2);
+        F vxi = S::set(a.vxi), vyi = S::set(a.vyi), pi = S::set(a.pi);
+        F fx = S::zero(), fy = S::zero(), kappa = S::zero();
+        for (int k = 0; k < n; k += S::width) {
+            M m = S::lanes(n - k);
+            auto vi = S::indices(idx + k, m);
+            F dx = S::sub(px, S::gather(a.x, vi, m, S::zero()));
+            F dy = S::sub(py, S::gather(a.y, vi, m, S::zero()));
+            F r2 = S::add(S::mul(dx, dx), S::mul(dy, dy));
+            M active = S::both(m, S::lt(r2, h2));
+            F r = needs_r ? S::sqrt(r2) : r2;
+            F inv_rho = S::gather(a.inv_rho, vi, active, S::zero());
+            if (Pressure::enabled && pressure.active()) {
+                // - (p_i + p_j) / (2 * pho_j) * diff_W(r, h)
+                F coef = S::mul(S::set(-0.5f), S::mul(S::add(S::gather(a.p, vi, active, S::zero()), pi), inv_rho));
+                coef = S::mul(coef, pressure.gradient(r2, r));
+                fx = S::add(fx, S::select(active, S::mul(dx, coef), S::zero()));
+                fy = S::add(fy, S::select(active, S::mul(dy, coef), S::zero()));
+            }
+            if (Viscous::enabled && viscous.active()) {
+                // miu * (vj - vi) / pho_j * laplace_W(r, h)
+                F coef = S::mul(S::mul(viscous.laplacian(r2, r), S::set(a.V)), inv_rho);
+                F dvx = S::sub(S::gather(a.vx, vi, active, S::zero()), vxi);
+                F dvy = S::sub(S::gather(a.vy, vi, active, S::zero()), vyi);
+                fx = S::add(fx, S::select(active, S::mul(dvx, coef), S::zero()));
+                fy = S::add(fy, S::select(active, S::mul(dvy, coef), S::zero()));
+            }
+            if (Tension::enabled && tension.active()) {
+                // - laplace_W(r, h) / pho_j
+                F l = S::mul(tension.laplacian(r2, r), inv_rho);
+                kappa = S::sub(kappa, S::select(active, l, S::zero()));
+            }
+        }
+        return ForceSum{S::sum(fx), S::sum(fy), S::sum(kappa)};
+    }
+
+    // functions of a backend for the given shapes. The kernel presets of Scenario.cpp
+    // (applyPreset, and basic_params for preset 4) get their own instantiations,
+    // other combinations switch on the shapes at runtime
+    template<class S>
+    Backend makeBackend(ISA isa, const Shapes &shapes) {
+        Backend b{isa, density<S, Dynamic<S>>, force<S, Dynamic<S>, Dynamic<S>, Dynamic<S>>};
+        if (shapes.rho == POLY6) {
+            b.density = density<S, Poly6<S>>;
+        }
+        Shape p = shapes.pressure, v = shapes.viscosity, t = shapes.tension;
+        if (p == POLY6 && v == NONE && t == NONE) {
+            // preset 1
+            b.force = force<S, Poly6<S>, Off<S>, Off<S>>;
+        } else if (p == SPIKY && v == NONE && t == NONE) {
+            // preset 2
+            b.force = force<S, Spiky<S>, Off<S>, Off<S>>;
+        } else if (p == SPIKY && v == VISCOSITY && t == NONE) {
+            // preset 3
+            b.force = force<S, Spiky<S>, Viscosity<S>, Off<S>>;
+        } else if (p == SPIKY && v == VISCOSITY && t == POLY6) {
+            // preset 4
+            b.force = force<S, Spiky<S>, Viscosity<S>, Poly6<S>>;
+        }
+        return b;
+    }
+}
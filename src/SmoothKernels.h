@@ -6,6 +6,8 @@
 #define CFD_2D_SMOOTH_KERNELS_H
 
 #include "Vec.h"
+#include <cmath>
+#include <vector>
 
 #define diff eval<SmoothKernels::DIFF>
 #define laplace eval<SmoothKernels::LAPLACE>
@@ -16,6 +18,13 @@ namespace SmoothKernels {
         DIFF = 1,
         LAPLACE = 2
     };
+    // closed form behind a kernel, CUSTOM for user functions
+    enum KernelKind {
+        CUSTOM = 0,
+        POLY6 = 1,
+        SPIKY = 2,
+        VISCOSITY = 3
+    };
     // kernel return a vector
     template<VectorSize size>
     using v_kernel_function = Vec<size>(Vec<size> &r);
@@ -23,6 +32,9 @@ namespace SmoothKernels {
     template<VectorSize size>
     using kernel_function = float(Vec<size> &r);
 
+    template<VectorSize size>
+    class KernelTable;
+
     template<VectorSize size>
     struct SmoothKernel {
     private:
@@ -32,13 +44,23 @@ namespace SmoothKernels {
         v_kernel_function<size> *d_func;
         // diff dot diff W(r, h), return a float
         kernel_function<size> *dd_func;
+        // which closed form, lets the solver evaluate it without the function pointers
+        KernelKind k;
+        // interpolated in place of the functions when set, see KernelTable
+        const KernelTable<size> *table{nullptr};
     public:
         auto operator()(Vec<size> &delta_r) {
+            if (table != nullptr) {
+                return table->template eval<ORIGIN>(delta_r);
+            }
             return (*func)(delta_r);
         }
 
         template<KernelForm form>
         auto eval(Vec<size> &delta_r) {
+            if (table != nullptr) {
+                return table->template eval<form>(delta_r);
+            }
             if constexpr (form == ORIGIN) {
                 return (*func)(delta_r);
             } else if constexpr (form == DIFF) {
@@ -48,11 +70,131 @@ namespace SmoothKernels {
             }
         }
 
-        SmoothKernel(kernel_function<size> f, v_kernel_function<size> df, kernel_function<size> lf) {
+        KernelKind kind() const {
+            return k;
+        }
+
+        // true for the kernels of a KernelTable
+        bool isTabulated() const {
+            return table != nullptr;
+        }
+
+        // the table interpolated in place of the functions, nullptr for closed forms
+        const KernelTable<size> *tabulation() const {
+            return table;
+        }
+
+        SmoothKernel(kernel_function<size> f, v_kernel_function<size> df, kernel_function<size> lf,
+                     KernelKind kernel_kind = CUSTOM) {
             this->func = f;
             this->d_func = df;
             this->dd_func = lf;
+            this->k = kernel_kind;
+        }
+
+        // a kernel interpolating table, the functions are kept for reference
+        SmoothKernel(const SmoothKernel &closed_form, const KernelTable<size> *t) : SmoothKernel(closed_form) {
+            this->k = CUSTOM;
+            this->table = t;
+        }
+    };
+
+    // W, diff W / r and laplace W of a kernel sampled at resolution + 1 evenly spaced
+    // values of |r|^2 in [0, h^2], read back with linear interpolation.
+    // Lookups need no sqrt and no division, and the 3 values of a sample share one
+    // 12 byte entry, so a table of 1024 samples stays in L1.
+    // Samples where the closed form is singular (|r| = 0 for some kernels) repeat
+    // the next sample. kernel() is a SmoothKernel for Fluid2DParameters::*_kernel,
+    // it runs on the generic path since the solver can't vectorize it
+    template<VectorSize size>
+    class KernelTable {
+    public:
+        // samples the functions of closed_form
+        KernelTable(SmoothKernel<size> &closed_form, float h, int resolution) :
+                KernelTable(closed_form, h, resolution, [&closed_form](float, float r, float &w, float &d, float &l) {
+                    Vec<size> delta_r;
+                    delta_r.x() = r;
+                    w = closed_form(delta_r);
+                    d = closed_form.template eval<DIFF>(delta_r).x() / r;
+                    l = closed_form.template eval<LAPLACE>(delta_r);
+                }) {}
+
+        // sample(|r|^2, |r|, w, d, l) sets W, diff W / r and laplace W, not finite where
+        // the kernel is singular. reference is kept in kernel() for the kind and the functions
+        template<class Sampler>
+        KernelTable(SmoothKernel<size> &reference, float h, int resolution, Sampler sample_at) :
+                table_h(h), h2(h * h), inv_step(float(resolution) / (h * h)),
+                samples(resolution + 2), sampled(reference.kind()), tabulated(reference, this) {
+            for (int i = resolution; i >= 0; i--) {
+                float r2 = float(i) / inv_step;
+                Sample sample{};
+                sample_at(r2, std::sqrt(r2), sample.w, sample.d, sample.l);
+                if (!std::isfinite(sample.w)) sample.w = samples[i + 1].w;
+                if (!std::isfinite(sample.d)) sample.d = samples[i + 1].d;
+                if (!std::isfinite(sample.l)) sample.l = samples[i + 1].l;
+                samples[i] = sample;
+            }
+            // the closed forms vanish at h, the extra sample keeps the last interval in range
+            samples[resolution + 1] = Sample{0, 0, 0};
         }
+
+        KernelTable(const KernelTable &) = delete;
+
+        KernelTable &operator=(const KernelTable &) = delete;
+
+        SmoothKernel<size> &kernel() {
+            return tabulated;
+        }
+
+        // smoothing length and kind of the kernel sampled
+        float h() const {
+            return table_h;
+        }
+
+        KernelKind sampledKind() const {
+            return sampled;
+        }
+
+        int resolution() const {
+            return int(samples.size()) - 2;
+        }
+
+        template<KernelForm form>
+        auto eval(Vec<size> &delta_r) const {
+            float r2 = delta_r.Mul(delta_r);
+            float t = r2 * inv_step;
+            if constexpr (form == DIFF) {
+                if (r2 >= h2) return Vec<size>();
+                return delta_r * interpolate(t, &Sample::d);
+            } else {
+                if (r2 >= h2) return 0.f;
+                return interpolate(t, form == ORIGIN ? &Sample::w : &Sample::l);
+            }
+        }
+
+    private:
+        struct Sample {
+            // W
+            float w;
+            // signed factor of the gradient, diff W = r * d
+            float d;
+            // laplace W
+            float l;
+        };
+
+        inline float interpolate(float t, float Sample::*value) const {
+            int i = int(t);
+            float f = t - float(i);
+            float a = samples[i].*value;
+            return a + f * (samples[i + 1].*value - a);
+        }
+
+        float table_h;
+        float h2;
+        float inv_step;
+        std::vector<Sample> samples;
+        KernelKind sampled;
+        SmoothKernel<size> tabulated;
     };
 }
 #endif //CFD_2D_SMOOTH_KERNELS_H
@@ -67,19 +209,22 @@ KERNEL_EXTERN(viscosity)
 // default kernels
 template<VectorSize size> SmoothKernels::SmoothKernel<size> &Poly6()
 {
-    static SmoothKernels::SmoothKernel<size> s_poly6(poly6<size>, d_poly6<size>, dd_poly6<size>);
+    static SmoothKernels::SmoothKernel<size> s_poly6(poly6<size>, d_poly6<size>, dd_poly6<size>,
+                                                      SmoothKernels::POLY6);
     return s_poly6;
 }
 
 template<VectorSize size> SmoothKernels::SmoothKernel<size> &DebrunSpiky()
 {
-    static SmoothKernels::SmoothKernel<size> s_spiky(spiky<size>, d_spiky<size>, dd_spiky<size>);
+    static SmoothKernels::SmoothKernel<size> s_spiky(spiky<size>, d_spiky<size>, dd_spiky<size>,
+                                                      SmoothKernels::SPIKY);
     return s_spiky;
 }
 
 template<VectorSize size> SmoothKernels::SmoothKernel<size> &Viscosity()
 {
-    static SmoothKernels::SmoothKernel<size> s_viscosity(viscosity<size>, d_viscosity<size>, dd_viscosity<size>);
+    static SmoothKernels::SmoothKernel<size> s_viscosity(viscosity<size>, d_viscosity<size>, dd_viscosity<size>,
+                                                          SmoothKernels::VISCOSITY);
     return s_viscosity;
 }
 #endif // KERNEL_WITH_H
\ No newline at end of file
@@ -10,43 +10,68 @@
 #include <memory>
 #include <future>
 #include <atomic>
+#include "MPMCQueue.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace nano_std {
 
+    // mutex protected FIFO on a ring buffer, it only allocates when it outgrows its capacity
     template<typename T>
     class TSafeQueue {
     private:
-        std::queue<T> data_queue;
+        std::vector<T> ring;
+        size_t head{0};
+        size_t count{0};
         mutable std::mutex mut;
 
     public:
         void push(T value) {
             std::lock_guard<std::mutex> lock(mut);
-            data_queue.push(std::move(value));
+            if (count == ring.size()) {
+                // unroll into a ring twice as large
+                std::vector<T> larger(ring.size() < 16 ? 32 : ring.size() * 2);
+                for (size_t i = 0; i < count; i++) {
+                    larger[i] = std::move(ring[(head + i) % ring.size()]);
+                }
+                ring.swap(larger);
+                head = 0;
+            }
+            ring[(head + count) % ring.size()] = std::move(value);
+            count++;
         }
 
         bool try_pop(T& value) {
             std::lock_guard<std::mutex> lock(mut);
-            if (data_queue.empty())
+            if (count == 0)
                 return false;
-            value = std::move(data_queue.front());
-            data_queue.pop();
+            value = std::move(ring[head]);
+            ring[head] = T();
+            head = (head + 1) % ring.size();
+            count--;
             return true;
         }
 
         size_t size() const {
             std::lock_guard<std::mutex> lock(mut);
-            return data_queue.size();
+            return count;
         }
 
         bool empty() const {
             std::lock_guard<std::mutex> lock(mut);
-            return data_queue.empty();
+            return count == 0;
         }
 
         void clear() {
             std::lock_guard<std::mutex> lock(mut);
-            while (!data_queue.empty()) data_queue.pop();
+            for (auto &item : ring) item = T();
+            head = 0;
+            count = 0;
         }
     };
 
@@ -73,48 +98,199 @@ namespace nano_std {
             if (t.joinable())
                 t.join();
         }
+
+        // keep the thread on one cpu, false if the platform does not support it
+        bool pin(int cpu) {
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            return pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) == 0;
+#else
+            (void) cpu;
+            return false;
+#endif
+        }
     };
 
     class ThreadPool {
+    public:
+        enum QueueKind {
+            // mutex protected queue, idle workers wait on a condition variable
+            LOCKED = 0,
+            // bounded lock free MPMCQueue, idle workers spin a little before they park
+            LOCK_FREE = 1
+        };
+
     private:
-        TSafeQueue<std::function<void(void)>> queue;
+        using Task = std::function<void(void)>;
+        QueueKind kind;
+        TSafeQueue<Task> queue;
+        MPMCQueue<Task> ring;
         std::vector<std::unique_ptr<WorkerThread>> workers;
         std::mutex queue_mutex;
         std::condition_variable cv_task;
         std::atomic<bool> stopped{false};
+        // lock free queue: workers parked on cv_task, producers only notify when there are some
+        std::atomic<int> parked{0};
         unsigned int current_index{0};
         unsigned int max_index{0};
+        unsigned int pinned_count{0};
+        // pool and index of the worker running on this thread
+        static inline thread_local const ThreadPool *current_pool{nullptr};
+        static inline thread_local unsigned int current_slot{0};
+
+        // polls of an idle lock free worker before it parks, the first ones only pause
+        static constexpr int spin_pauses = 64;
+        static constexpr int spin_yields = 16;
+
+        static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+            _mm_pause();
+#else
+            std::this_thread::yield();
+#endif
+        }
+
+        // one task or one wait of a worker, called in a loop
+        void work_locked() {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                cv_task.wait(lock, [this] {
+                    return stopped || !queue.empty();
+                });
+                if (stopped && queue.empty()) return;
+                if (!queue.try_pop(task)) return;
+            }
+            task();
+        }
+
+        void work_lock_free() {
+            Task task;
+            for (int k = 0; k < spin_pauses + spin_yields; k++) {
+                if (ring.try_pop(task)) {
+                    task();
+                    return;
+                }
+                if (k < spin_pauses) {
+                    pause();
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            // park, the producer reads parked after its push, so one of the two sees the other
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            parked.fetch_add(1, std::memory_order_seq_cst);
+            cv_task.wait(lock, [this] {
+                return stopped || !ring.empty();
+            });
+            parked.fetch_sub(1, std::memory_order_relaxed);
+        }
 
     public:
-        explicit ThreadPool(unsigned int count) {
+        // cpus this process may run on, in order. Respects taskset and cgroup cpu sets on linux,
+        // elsewhere 0 ~ hardware_concurrency - 1
+        static std::vector<int> availableCpus() {
+            std::vector<int> cpus;
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+                for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                    if (CPU_ISSET(cpu, &set)) {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+#endif
+            if (cpus.empty()) {
+                unsigned int n = std::thread::hardware_concurrency();
+                for (unsigned int cpu = 0; cpu < (n > 0 ? n : 1); cpu++) {
+                    cpus.push_back(int(cpu));
+                }
+            }
+            return cpus;
+        }
+
+        // pin: worker i stays on the i-th available cpu, wrapping around when there are
+        // more workers than cpus. A pool of 0 workers runs every task on the calling thread
+        explicit ThreadPool(unsigned int count, QueueKind queue_kind = LOCK_FREE, bool pin = false)
+                : kind(queue_kind) {
             max_index = count;
+            std::vector<int> cpus;
+            if (pin) {
+                cpus = availableCpus();
+            }
             for (unsigned int i = 0; i < count; i++) {
                 auto worker = std::make_unique<WorkerThread>();
-                worker->run([this]() {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(queue_mutex);
-                        cv_task.wait(lock, [this] {
-                            return stopped || !queue.empty();
-                        });
-                        if (stopped && queue.empty()) return;
-                        if (!queue.try_pop(task)) return;
+                worker->run([this, i]() {
+                    current_pool = this;
+                    current_slot = i;
+                    if (kind == LOCK_FREE) {
+                        work_lock_free();
+                    } else {
+                        work_locked();
                     }
-                    task();
                 });
+                if (pin && worker->pin(cpus[i % cpus.size()])) {
+                    pinned_count++;
+                }
                 workers.push_back(std::move(worker));
             }
         }
 
         ~ThreadPool() {
-            stopped = true;
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                stopped = true;
+            }
             cv_task.notify_all();
             for (auto& w : workers) {
                 w->stop();
             }
         }
 
+        QueueKind queueKind() const {
+            return kind;
+        }
+
+        // number of workers
+        unsigned int size() const {
+            return max_index;
+        }
+
+        // number of workers pinned to a cpu
+        unsigned int pinned() const {
+            return pinned_count;
+        }
+
+        // index of the calling worker, size() for threads outside the pool.
+        // Lets callers keep one scratch buffer per thread in [0, size()]
+        unsigned int slot() const {
+            return current_pool == this ? current_slot : max_index;
+        }
+
         void doAsync(std::function<void(void)> task) {
+            if (max_index == 0) {
+                task();
+                return;
+            }
+            if (kind == LOCK_FREE) {
+                // full: run queued tasks here until there is room
+                while (!ring.try_push(std::move(task))) {
+                    Task other;
+                    if (ring.try_pop(other)) {
+                        other();
+                    }
+                }
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (parked.load(std::memory_order_seq_cst) > 0) {
+                    std::lock_guard<std::mutex> lock(queue_mutex);
+                    cv_task.notify_one();
+                }
+                return;
+            }
             {
                 std::lock_guard<std::mutex> lock(queue_mutex);
                 queue.push(std::move(task));
@@ -170,6 +346,93 @@ namespace nano_std {
                 return count == 0;
             });
         }
+
+        // run body() on the calling thread and on helpers more threads of the pool, at most
+        // one per worker, and wait for all of them. The bodies share the work among themselves
+        template<typename Body>
+        void parallel_run(int helpers, Body &&body) {
+            helpers = helpers < int(max_index) ? helpers : int(max_index);
+            // two references, small enough for std::function to store without allocating
+            struct {
+                int count;
+                std::mutex mx;
+                std::condition_variable cv;
+            } done;
+            done.count = helpers;
+            for (int i = 0; i < helpers; i++) {
+                doAsync([&body, &done]() {
+                    body();
+                    std::unique_lock<std::mutex> lock(done.mx);
+                    if (--done.count == 0) {
+                        done.cv.notify_one();
+                    }
+                });
+            }
+            body();
+            std::unique_lock<std::mutex> lock(done.mx);
+            done.cv.wait(lock, [&done]() {
+                return done.count == 0;
+            });
+        }
+
+        // run body(first, last) over the chunks [begin + k * grain, begin + (k + 1) * grain)
+        // of [begin, end) and wait for all of them. The calling thread and up to one task
+        // per worker take chunks from a shared counter, so a phase is queued only once
+        // however many chunks it has
+        template<typename Body>
+        void parallel_for(int begin, int end, int grain, Body &&body) {
+            grain = grain < 1 ? 1 : grain;
+            int chunks = end > begin ? (end - begin - 1) / grain + 1 : 0;
+            if (chunks <= 1) {
+                if (chunks == 1) {
+                    body(begin, end);
+                }
+                return;
+            }
+            std::atomic<int> next{0};
+            parallel_run(chunks - 1, [&]() {
+                for (int k = next.fetch_add(1, std::memory_order_relaxed); k < chunks;
+                     k = next.fetch_add(1, std::memory_order_relaxed)) {
+                    int first = begin + k * grain;
+                    body(first, first + grain < end ? first + grain : end);
+                }
+            });
+        }
+
+        // combine(combine(identity, body(chunk 0)), body(chunk 1)) ... over the chunks of
+        // parallel_for, body(first, last) returns the partial result of one chunk.
+        // Partials are combined in chunk order, so the result does not depend on the workers.
+        // The grain grows if the range would need more than max_reduce_chunks chunks
+        static constexpr int max_reduce_chunks = 256;
+
+        template<typename T, typename Body, typename Combine>
+        T parallel_reduce(int begin, int end, int grain, T identity, Body &&body, Combine &&combine) {
+            int length = end > begin ? end - begin : 0;
+            grain = grain < 1 ? 1 : grain;
+            if (length > grain * max_reduce_chunks) {
+                grain = (length - 1) / max_reduce_chunks + 1;
+            }
+            int chunks = length > 0 ? (length - 1) / grain + 1 : 0;
+            T partial[max_reduce_chunks];
+            parallel_for(begin, end, grain, [&](int first, int last) {
+                partial[(first - begin) / grain] = body(first, last);
+            });
+            T result = identity;
+            for (int k = 0; k < chunks; k++) {
+                result = combine(result, partial[k]);
+            }
+            return result;
+        }
+
+        // run body(0) ... body(count - 1) in parallel and wait for all of them
+        template<typename Body>
+        void syncChunks(int count, Body &&body) {
+            parallel_for(0, count, 1, [&body](int first, int last) {
+                for (int i = first; i < last; i++) {
+                    body(i);
+                }
+            });
+        }
     };
 
 }
@@ -0,0 +1,72 @@
+//
+// Created by ZhangHao on 2022/12/14.
+//
+
+#include "TileGraph.h"
+#include <algorithm>
+
+// (y, x) order, the same as the cell ids
+static inline unsigned long long tile_key(int x, int y) {
+    return (static_cast<unsigned long long>(static_cast<unsigned int>(y) ^ 0x80000000u) << 32) |
+           (static_cast<unsigned int>(x) ^ 0x80000000u);
+}
+
+// rounds towards -inf, hashed grid cells may have negative coordinates
+static inline int floor_div(int a, int b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+void TileGraph::reserve(int cells) {
+    // at most one tile per cell, and 9 neighbour tiles per tile
+    size_t count = size_t(std::max(cells, 0));
+    keys.reserve(count);
+    tile_keys.reserve(count);
+    tile_start.reserve(count + 1);
+    tile_cells.reserve(count);
+    neighbour_start.reserve(count + 1);
+    neighbour_tiles.reserve(9 * count);
+    pending.reserve(count);
+    ready.reserve(count);
+}
+
+void TileGraph::build(const std::vector<CellGrid::Cell> &cells, int size) {
+    tile_size = std::max(1, size);
+    keys.resize(cells.size());
+    for (size_t c = 0; c < cells.size(); c++) {
+        keys[c] = {tile_key(floor_div(cells[c].x, tile_size), floor_div(cells[c].y, tile_size)), int(c)};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    // within the capacity of reserve, growing fluid does not reallocate
+    tile_keys.clear();
+    tile_start.clear();
+    tile_cells.resize(keys.size());
+    for (size_t c = 0; c < keys.size(); c++) {
+        if (c == 0 || keys[c].first != keys[c - 1].first) {
+            tile_keys.push_back(keys[c].first);
+            tile_start.push_back(int(c));
+        }
+        tile_cells[c] = keys[c].second;
+    }
+    tile_start.push_back(int(keys.size()));
+
+    int count = int(tile_keys.size());
+    neighbour_start.resize(count + 1);
+    neighbour_tiles.clear();
+    for (int t = 0; t < count; t++) {
+        neighbour_start[t] = int(neighbour_tiles.size());
+        int x = int(static_cast<unsigned int>(tile_keys[t]) ^ 0x80000000u);
+        int y = int(static_cast<unsigned int>(tile_keys[t] >> 32) ^ 0x80000000u);
+        for (int d = -1; d < 2; d++) {
+            for (int k = -1; k < 2; k++) {
+                auto found = std::lower_bound(tile_keys.begin(), tile_keys.end(), tile_key(x + k, y + d));
+                if (found != tile_keys.end() && *found == tile_key(x + k, y + d)) {
+                    neighbour_tiles.push_back(int(found - tile_keys.begin()));
+                }
+            }
+        }
+    }
+    neighbour_start[count] = int(neighbour_tiles.size());
+    pending.resize(count);
+    ready.resize(count);
+}
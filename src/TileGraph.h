@@ -0,0 +1,116 @@
+//
+// Created by ZhangHao on 2022/12/14.
+//
+
+#ifndef CFD_2D_TILE_GRAPH_H
+#define CFD_2D_TILE_GRAPH_H
+
+#include "CellGrid.h"
+#include "ThreadPool.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// occupied cells grouped into square tiles of size x size cells, and a two stage
+// schedule over them: the second stage of a tile may start as soon as the first
+// stage finished on the tile and its 8 neighbour tiles, the rest of the domain
+// does not have to be done. Stages of one cell may read the first stage results
+// of cells at most size cells away.
+// Threads prefer second stage tiles that are ready and take first stage tiles
+// otherwise, in tile order, so the two stages overlap instead of meeting at a barrier
+class TileGraph {
+public:
+    // room for up to cells occupied cells, build only allocates past it
+    void reserve(int cells);
+
+    // group cells, in (y, x) order as CellGrid::occupied gives them, into tiles
+    void build(const std::vector<CellGrid::Cell> &cells, int size);
+
+    int tiles() const {
+        return int(tile_start.size()) - 1;
+    }
+
+    // side of a tile in cells
+    int tileSize() const {
+        return tile_size;
+    }
+
+    // run first(c) then second(c) for every cell index c given to build, with the
+    // calling thread and the workers of pool, and wait for all of them
+    template<typename First, typename Second>
+    void run(nano_std::ThreadPool *pool, First &&first, Second &&second) {
+        int count = tiles();
+        if (count <= 0) {
+            return;
+        }
+        for (int t = 0; t < count; t++) {
+            pending[t] = neighbour_start[t + 1] - neighbour_start[t];
+            ready[t] = -1;
+        }
+        std::atomic<int> next_first{0};
+        std::atomic<int> next_second{0};
+        std::atomic<int> ready_count{0};
+        pool->parallel_run(count - 1, [&]() {
+            for (int idle = 0;;) {
+                // ready second stages first, their neighbours were just computed and are in cache
+                int k = next_second.load(std::memory_order_relaxed);
+                if (k < ready_count.load(std::memory_order_acquire)) {
+                    if (next_second.compare_exchange_weak(k, k + 1, std::memory_order_relaxed)) {
+                        // the slot is claimed before the tile is written, wait for the write
+                        std::atomic_ref<int> slot(ready[k]);
+                        int t;
+                        while ((t = slot.load(std::memory_order_acquire)) < 0) {
+                            std::this_thread::yield();
+                        }
+                        for (int c = tile_start[t]; c < tile_start[t + 1]; c++) {
+                            second(tile_cells[c]);
+                        }
+                        idle = 0;
+                    }
+                    continue;
+                }
+                int t = next_first.fetch_add(1, std::memory_order_relaxed);
+                if (t < count) {
+                    for (int c = tile_start[t]; c < tile_start[t + 1]; c++) {
+                        first(tile_cells[c]);
+                    }
+                    // the last neighbour to finish makes the tile ready
+                    for (int n = neighbour_start[t]; n < neighbour_start[t + 1]; n++) {
+                        int u = neighbour_tiles[n];
+                        if (std::atomic_ref<int>(pending[u]).fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                            int s = ready_count.fetch_add(1, std::memory_order_relaxed);
+                            std::atomic_ref<int>(ready[s]).store(u, std::memory_order_release);
+                        }
+                    }
+                    idle = 0;
+                    continue;
+                }
+                if (k >= count) {
+                    return;
+                }
+                // every first stage is taken, wait for the neighbours of the next tile
+                if (++idle > 64) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+private:
+    int tile_size{1};
+    // (tile key, cell index) of all cells, sorted
+    std::vector<std::pair<unsigned long long, int>> keys;
+    // key of each tile, ascending
+    std::vector<unsigned long long> tile_keys;
+    // cells of tile t are tile_cells[tile_start[t]] ... tile_cells[tile_start[t + 1] - 1]
+    std::vector<int> tile_start;
+    std::vector<int> tile_cells;
+    // tiles of the 3 x 3 block around each tile, itself included, in the same CSR form
+    std::vector<int> neighbour_start;
+    std::vector<int> neighbour_tiles;
+    // first stage neighbours left of each tile, and tiles in the order they became ready
+    std::vector<int> pending;
+    std::vector<int> ready;
+};
+
+#endif //CFD_2D_TILE_GRAPH_H
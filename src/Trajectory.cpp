@@ -0,0 +1,367 @@
+//
+// Created by ZhangHao on 2022/12/16.
+//
+
+#include "Trajectory.h"
+#include "LineBoundary.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace Trajectory {
+
+    static const char file_magic[8] = {'C', 'F', 'D', '2', 'D', 'T', 'R', 'J'};
+    static const char index_magic[8] = {'C', 'F', 'D', '2', 'D', 'I', 'D', 'X'};
+    // largest quantized value
+    static const float q_max = 65535.f;
+
+    static inline uint16_t quantize(float v, float origin, float scale) {
+        float q = std::round((v - origin) * scale);
+        return uint16_t(std::min(std::max(q, 0.f), q_max));
+    }
+
+    // signed difference of two 16 bit values, small magnitudes first: 0, -1, 1, -2, ...
+    static inline uint32_t zigzag(uint16_t now, uint16_t before) {
+        auto d = int16_t(uint16_t(now - before));
+        return uint16_t((uint16_t(d) << 1) ^ uint16_t(d >> 15));
+    }
+
+    static inline uint16_t unzigzag(uint32_t z, uint16_t before) {
+        auto d = uint16_t((z >> 1) ^ (0u - (z & 1)));
+        return uint16_t(before + d);
+    }
+
+    static inline unsigned char *put_varint(unsigned char *out, uint32_t v) {
+        while (v >= 0x80) {
+            *out++ = (unsigned char) (v | 0x80);
+            v >>= 7;
+        }
+        *out++ = (unsigned char) v;
+        return out;
+    }
+
+    bool Writer::open(const std::string &path, const Fluid2D &fluid, unsigned int every,
+                      unsigned int depth, unsigned int keyframe_interval) {
+        close();
+        const Fluid2D::Fluid2DParameters &params = fluid.params;
+        particle_count = params.particle_count;
+        step_interval = std::max(1u, every);
+        key_interval = std::max(1u, keyframe_interval);
+        left = params.left;
+        bottom = params.bottom;
+        scale_x = q_max / (params.right - params.left);
+        scale_y = q_max / (params.top - params.bottom);
+
+        std::vector<Wall> walls;
+        for (auto &boundary : fluid.allBoundaries()) {
+            if (auto *line = dynamic_cast<const LineBoundary *>(boundary.get())) {
+                walls.push_back(Wall{line->uniformStart().x(), line->uniformStart().y(),
+                                     line->uniformEnd().x(), line->uniformEnd().y(), line->damping()});
+            }
+        }
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            last_error = "could not create " + path;
+            return false;
+        }
+        Header header{};
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = version;
+        header.header_size = sizeof(Header);
+        header.particle_count = particle_count;
+        header.boundary_count = uint32_t(walls.size());
+        header.step_interval = step_interval;
+        header.keyframe_interval = key_interval;
+        header.left = params.left;
+        header.bottom = params.bottom;
+        header.right = params.right;
+        header.top = params.top;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+        out.write(reinterpret_cast<const char *>(walls.data()), std::streamsize(walls.size() * sizeof(Wall)));
+        offset = sizeof(Header) + walls.size() * sizeof(Wall);
+
+        // everything a frame needs is allocated here, capturing and writing reuse it
+        depth = std::max(1u, depth);
+        slots.resize(depth);
+        free_slots.clear();
+        for (unsigned int s = 0; s < depth; s++) {
+            slots[s].x.assign(particle_count, 0);
+            slots[s].y.assign(particle_count, 0);
+            free_slots.push_back(int(s));
+        }
+        full_slots.assign(depth, 0);
+        full_head = 0;
+        full_count = 0;
+        closing = false;
+        prev_x.assign(particle_count, 0);
+        prev_y.assign(particle_count, 0);
+        // 3 bytes per coordinate at most
+        payload.resize(size_t(particle_count) * 6);
+        index.clear();
+        index.reserve(1024);
+        write_failed = false;
+        captured = written = dropped = 0;
+        bytes = last_bytes = busy_ns = 0;
+        io = std::thread([this]() {
+            write_frames();
+        });
+        return true;
+    }
+
+    bool Writer::capture(const Fluid2D &fluid) {
+        Fluid2D::State state = fluid.state();
+        if (!isOpen() || state.count != particle_count) {
+            return false;
+        }
+        int s;
+        {
+            std::lock_guard<std::mutex> lock(mx);
+            if (free_slots.empty()) {
+                dropped++;
+                return false;
+            }
+            s = free_slots.back();
+            free_slots.pop_back();
+        }
+        Slot &slot = slots[s];
+        for (unsigned int i = 0; i < particle_count; i++) {
+            unsigned int id = state.ids != nullptr ? state.ids[i] : i;
+            slot.x[id] = quantize(state.x[i], left, scale_x);
+            slot.y[id] = quantize(state.y[i], bottom, scale_y);
+        }
+        slot.step = state.step;
+        slot.time = state.simulated_time;
+        {
+            std::lock_guard<std::mutex> lock(mx);
+            full_slots[(full_head + full_count) % full_slots.size()] = s;
+            full_count++;
+        }
+        cv.notify_one();
+        captured++;
+        return true;
+    }
+
+    void Writer::write_frames() {
+        for (;;) {
+            int s;
+            {
+                std::unique_lock<std::mutex> lock(mx);
+                cv.wait(lock, [this]() {
+                    return full_count > 0 || closing;
+                });
+                if (full_count == 0) {
+                    return;
+                }
+                s = full_slots[full_head];
+            }
+            write_frame(slots[s]);
+            {
+                std::lock_guard<std::mutex> lock(mx);
+                full_head = (full_head + 1) % full_slots.size();
+                full_count--;
+                free_slots.push_back(s);
+            }
+        }
+    }
+
+    void Writer::write_frame(const Slot &slot) {
+        auto start = std::chrono::steady_clock::now();
+        bool key = written % key_interval == 0;
+        if (key) {
+            std::fill(prev_x.begin(), prev_x.end(), 0);
+            std::fill(prev_y.begin(), prev_y.end(), 0);
+        }
+        unsigned char *end = payload.data();
+        for (unsigned int i = 0; i < particle_count; i++) {
+            end = put_varint(end, zigzag(slot.x[i], prev_x[i]));
+            end = put_varint(end, zigzag(slot.y[i], prev_y[i]));
+        }
+        std::copy(slot.x.begin(), slot.x.end(), prev_x.begin());
+        std::copy(slot.y.begin(), slot.y.end(), prev_y.begin());
+
+        FrameHeader frame{frame_magic, key ? 1u : 0u, slot.step, slot.time, uint64_t(end - payload.data())};
+        out.write(reinterpret_cast<const char *>(&frame), sizeof(FrameHeader));
+        out.write(reinterpret_cast<const char *>(payload.data()), std::streamsize(frame.payload_bytes));
+        if (!out) {
+            write_failed = true;
+        }
+        index.push_back(IndexEntry{offset, slot.step});
+        uint64_t frame_bytes = sizeof(FrameHeader) + frame.payload_bytes;
+        offset += frame_bytes;
+        bytes += frame_bytes;
+        last_bytes = frame_bytes;
+        written++;
+        busy_ns += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+    }
+
+    bool Writer::close() {
+        if (!isOpen()) {
+            return true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mx);
+            closing = true;
+        }
+        cv.notify_all();
+        io.join();
+        Trailer trailer{index.size(), offset, {}};
+        std::memcpy(trailer.magic, index_magic, sizeof(index_magic));
+        out.write(reinterpret_cast<const char *>(index.data()), std::streamsize(index.size() * sizeof(IndexEntry)));
+        out.write(reinterpret_cast<const char *>(&trailer), sizeof(Trailer));
+        out.close();
+        if (write_failed || !out) {
+            last_error = "could not write the trajectory";
+            return false;
+        }
+        return true;
+    }
+
+    Writer::Stats Writer::stats() const {
+        unsigned long frames = written;
+        return Stats{captured, frames, dropped, bytes, last_bytes,
+                     uint64_t(frames) * particle_count * 2 * sizeof(float), double(busy_ns) * 1e-9};
+    }
+
+    bool Reader::open(const std::string &path) {
+        close();
+        if (!file.open(path)) {
+            last_error = "could not open " + path;
+            return false;
+        }
+        const char *data = file.data();
+        size_t size = file.size();
+        if (size < sizeof(Header)) {
+            last_error = path + " is not a trajectory";
+            close();
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(Header));
+        if (std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0) {
+            last_error = path + " is not a trajectory";
+            close();
+            return false;
+        }
+        size_t frames_offset = sizeof(Header) + size_t(header.boundary_count) * sizeof(Wall);
+        if (header.version != version || header.header_size != sizeof(Header) || frames_offset > size) {
+            last_error = path + " has trajectory version " + std::to_string(header.version) +
+                         ", expected " + std::to_string(version);
+            close();
+            return false;
+        }
+        wall_list.resize(header.boundary_count);
+        std::memcpy(wall_list.data(), data + sizeof(Header), wall_list.size() * sizeof(Wall));
+
+        // the index of a closed file, otherwise walk the frames that were written completely
+        Trailer trailer{};
+        if (size >= frames_offset + sizeof(Trailer)) {
+            std::memcpy(&trailer, data + size - sizeof(Trailer), sizeof(Trailer));
+        }
+        if (std::memcmp(trailer.magic, index_magic, sizeof(index_magic)) == 0 &&
+            trailer.index_offset + trailer.frame_count * sizeof(IndexEntry) + sizeof(Trailer) == size) {
+            index.resize(trailer.frame_count);
+            std::memcpy(index.data(), data + trailer.index_offset, index.size() * sizeof(IndexEntry));
+        } else {
+            for (size_t at = frames_offset; at + sizeof(FrameHeader) <= size;) {
+                FrameHeader frame{};
+                std::memcpy(&frame, data + at, sizeof(FrameHeader));
+                if (frame.magic != frame_magic || frame.payload_bytes > size - at - sizeof(FrameHeader)) {
+                    break;
+                }
+                index.push_back(IndexEntry{at, frame.step});
+                at += sizeof(FrameHeader) + frame.payload_bytes;
+            }
+        }
+        keys.resize(index.size());
+        for (size_t f = 0; f < index.size(); f++) {
+            FrameHeader frame{};
+            if (index[f].offset + sizeof(FrameHeader) > size) {
+                index.resize(f);
+                keys.resize(f);
+                break;
+            }
+            std::memcpy(&frame, data + index[f].offset, sizeof(FrameHeader));
+            keys[f] = frame.key || f == 0 ? f : keys[f - 1];
+        }
+        qx.assign(header.particle_count, 0);
+        qy.assign(header.particle_count, 0);
+        current = SIZE_MAX;
+        return true;
+    }
+
+    void Reader::close() {
+        file.close();
+        header = Header{};
+        wall_list.clear();
+        index.clear();
+        keys.clear();
+        current = SIZE_MAX;
+    }
+
+    double Reader::time(size_t frame) const {
+        FrameHeader header_of_frame{};
+        std::memcpy(&header_of_frame, file.data() + index[frame].offset, sizeof(FrameHeader));
+        return header_of_frame.time;
+    }
+
+    bool Reader::decode(size_t frame) {
+        FrameHeader frame_header{};
+        std::memcpy(&frame_header, file.data() + index[frame].offset, sizeof(FrameHeader));
+        auto *in = reinterpret_cast<const unsigned char *>(file.data() + index[frame].offset + sizeof(FrameHeader));
+        const unsigned char *end = in + std::min<uint64_t>(frame_header.payload_bytes,
+                                                            file.size() - index[frame].offset - sizeof(FrameHeader));
+        if (frame_header.magic != frame_magic) {
+            return false;
+        }
+        if (frame_header.key) {
+            std::fill(qx.begin(), qx.end(), 0);
+            std::fill(qy.begin(), qy.end(), 0);
+        }
+        auto get_varint = [&](uint32_t &v) {
+            v = 0;
+            for (int shift = 0; in < end && shift < 21; shift += 7) {
+                unsigned char b = *in++;
+                v |= uint32_t(b & 0x7f) << shift;
+                if ((b & 0x80) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        for (unsigned int i = 0; i < header.particle_count; i++) {
+            uint32_t zx, zy;
+            if (!get_varint(zx) || !get_varint(zy)) {
+                return false;
+            }
+            qx[i] = unzigzag(zx, qx[i]);
+            qy[i] = unzigzag(zy, qy[i]);
+        }
+        return true;
+    }
+
+    bool Reader::read(size_t frame, float *x, float *y) {
+        if (frame >= index.size()) {
+            return false;
+        }
+        if (frame != current) {
+            // continue from the decoded frame when it lies between the key frame and this one
+            size_t first = current != SIZE_MAX && current < frame && current >= keys[frame] ? current + 1 : keys[frame];
+            for (size_t f = first; f <= frame; f++) {
+                if (!decode(f)) {
+                    current = SIZE_MAX;
+                    last_error = "frame " + std::to_string(f) + " is damaged";
+                    return false;
+                }
+                current = f;
+            }
+        }
+        float step_x = (header.right - header.left) / q_max;
+        float step_y = (header.top - header.bottom) / q_max;
+        for (unsigned int i = 0; i < header.particle_count; i++) {
+            x[i] = header.left + float(qx[i]) * step_x;
+            y[i] = header.bottom + float(qy[i]) * step_y;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,247 @@
+//
+// Created by ZhangHao on 2022/12/16.
+//
+
+#ifndef CFD_2D_TRAJECTORY_H
+#define CFD_2D_TRAJECTORY_H
+
+#include "Fluid2D.h"
+#include "MappedFile.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// recorded positions of a run. Positions are quantized to 16 bits over the domain box,
+// particles outside of it are clamped to its border. File layout, native byte order:
+//   Header, boundary_count Wall records
+//   frames: FrameHeader and payload. The payload holds, for every particle in initial
+//   order, x then y as the difference to the previous frame, zigzag encoded in 7 bit
+//   groups, so particles that barely moved take a byte per coordinate. Key frames are
+//   differences to 0 and can be decoded on their own
+//   the index, one IndexEntry per frame, and the Trailer. Files without them, after
+//   a crash, are read by walking the frames
+namespace Trajectory {
+    static constexpr uint32_t version = 1;
+    static constexpr uint32_t frame_magic = 0x454d5246u;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t particle_count;
+        uint32_t boundary_count;
+        // steps between two frames, and frames from a key frame to the next one
+        uint32_t step_interval;
+        uint32_t keyframe_interval;
+        float left, bottom, right, top;
+    };
+
+    // a line boundary in the uniform CS, see LineBoundary
+    struct Wall {
+        float start_x, start_y;
+        float end_x, end_y;
+        float damp;
+    };
+
+    struct FrameHeader {
+        uint32_t magic;
+        uint32_t key;
+        uint64_t step;
+        double time;
+        uint64_t payload_bytes;
+    };
+
+    struct IndexEntry {
+        uint64_t offset;
+        uint64_t step;
+    };
+
+    struct Trailer {
+        uint64_t frame_count;
+        uint64_t index_offset;
+        char magic[8];
+    };
+
+    // records frames of a run to a file. The solver thread only quantizes the positions into
+    // one of depth preallocated slots, delta encoding and writing happen on an I/O thread.
+    // When every slot waits for the disk the frame is dropped, the solver never waits
+    class Writer {
+    public:
+        struct Stats {
+            // frames handed to the writer, written to the file and dropped on a full queue
+            unsigned long captured;
+            unsigned long written;
+            unsigned long dropped;
+            // file bytes of the frames written, of the last frame, and as raw float positions
+            uint64_t bytes;
+            uint64_t last_frame_bytes;
+            uint64_t raw_bytes;
+            // time the I/O thread spent encoding and writing
+            double busy_seconds;
+        };
+
+        Writer() = default;
+
+        Writer(const Writer &) = delete;
+
+        Writer &operator=(const Writer &) = delete;
+
+        ~Writer() {
+            close();
+        }
+
+        // create path for the particles and boundaries of fluid, a frame every `every` steps.
+        // Line boundaries are recorded, other boundaries are skipped
+        bool open(const std::string &path, const Fluid2D &fluid, unsigned int every,
+                  unsigned int depth = 8, unsigned int keyframe_interval = 60);
+
+        // call after every step on the solver thread, records a frame every `every` steps
+        void onStep(const Fluid2D &fluid) {
+            if (isOpen() && fluid.state().step % step_interval == 0) {
+                capture(fluid);
+            }
+        }
+
+        // queue the positions of fluid now, false if the frame was dropped.
+        // Only between steps, on the solver thread
+        bool capture(const Fluid2D &fluid);
+
+        // write the queued frames and the index, and close the file
+        bool close();
+
+        bool isOpen() const {
+            return io.joinable();
+        }
+
+        // steps between two frames
+        unsigned int interval() const {
+            return step_interval;
+        }
+
+        Stats stats() const;
+
+        const std::string &error() const {
+            return last_error;
+        }
+
+    private:
+        // quantized positions in initial particle order, and when they were taken
+        struct Slot {
+            std::vector<uint16_t> x;
+            std::vector<uint16_t> y;
+            uint64_t step;
+            double time;
+        };
+
+        std::ofstream out;
+        std::string last_error;
+        unsigned int particle_count{0};
+        unsigned int step_interval{1};
+        unsigned int key_interval{1};
+        float left{0}, bottom{0}, scale_x{1}, scale_y{1};
+
+        std::vector<Slot> slots;
+        // slot indices, free ones for the solver and full ones for the I/O thread
+        std::vector<int> free_slots;
+        std::vector<int> full_slots;
+        size_t full_head{0};
+        size_t full_count{0};
+        std::mutex mx;
+        std::condition_variable cv;
+        bool closing{false};
+        std::thread io;
+
+        // I/O thread: previous frame, encoded payload and the index
+        std::vector<uint16_t> prev_x;
+        std::vector<uint16_t> prev_y;
+        std::vector<unsigned char> payload;
+        std::vector<IndexEntry> index;
+        uint64_t offset{0};
+        bool write_failed{false};
+
+        std::atomic<unsigned long> captured{0};
+        std::atomic<unsigned long> written{0};
+        std::atomic<unsigned long> dropped{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> last_bytes{0};
+        std::atomic<uint64_t> busy_ns{0};
+
+        void write_frames();
+
+        void write_frame(const Slot &slot);
+    };
+
+    // reads a recorded file through a mapping, frames are decoded when asked for
+    class Reader {
+    public:
+        bool open(const std::string &path);
+
+        void close();
+
+        bool isOpen() const {
+            return file.isOpen();
+        }
+
+        unsigned int particles() const {
+            return header.particle_count;
+        }
+
+        size_t frames() const {
+            return index.size();
+        }
+
+        uint64_t step(size_t frame) const {
+            return index[frame].step;
+        }
+
+        double time(size_t frame) const;
+
+        // frames from a key frame to the next
+        unsigned int keyInterval() const {
+            return header.keyframe_interval;
+        }
+
+        const std::vector<Wall> &walls() const {
+            return wall_list;
+        }
+
+        // domain box the positions were quantized to
+        void domain(float &left, float &bottom, float &right, float &top) const {
+            left = header.left;
+            bottom = header.bottom;
+            right = header.right;
+            top = header.top;
+        }
+
+        // positions of a frame in initial particle order, particles() values each.
+        // The next frame costs one delta frame, any other starts at its key frame
+        bool read(size_t frame, float *x, float *y);
+
+        const std::string &error() const {
+            return last_error;
+        }
+
+    private:
+        nano_std::MappedFile file;
+        Header header{};
+        std::vector<Wall> wall_list;
+        std::vector<IndexEntry> index;
+        // key frame at or before each frame
+        std::vector<size_t> keys;
+        // quantized positions of frame `current`
+        std::vector<uint16_t> qx;
+        std::vector<uint16_t> qy;
+        size_t current{SIZE_MAX};
+        std::string last_error;
+
+        // apply the payload of a frame to qx, qy, false if it is damaged
+        bool decode(size_t frame);
+    };
+}
+
+#endif //CFD_2D_TRAJECTORY_H
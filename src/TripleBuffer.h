@@ -0,0 +1,67 @@
+//
+// Created by ZhangHao on 2022/12/12.
+//
+
+#ifndef CFD_2D_TRIPLE_BUFFER_H
+#define CFD_2D_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+namespace nano_std {
+
+    // single producer, single consumer handoff of whole frames without locks or copies.
+    // The producer fills back() and publishes it, the consumer takes the newest
+    // published frame with acquire() and reads front(). Slots only change hands by
+    // index, so the producer never waits for the consumer and never writes the
+    // slot the consumer reads.
+    template<typename T>
+    class TripleBuffer {
+    public:
+        // producer: slot to fill, not visible to the consumer
+        T &back() {
+            return slots[back_index];
+        }
+
+        // producer: hand back() to the consumer, back() becomes another slot
+        void publish() {
+            unsigned int prev = shared.exchange(back_index | fresh, std::memory_order_acq_rel);
+            back_index = prev & index_mask;
+        }
+
+        // consumer: take the newest published slot, return false if there is nothing new
+        bool acquire() {
+            if ((shared.load(std::memory_order_relaxed) & fresh) == 0) {
+                return false;
+            }
+            unsigned int prev = shared.exchange(front_index, std::memory_order_acq_rel);
+            front_index = prev & index_mask;
+            return true;
+        }
+
+        // consumer: the slot taken by the last acquire
+        const T &front() const {
+            return slots[front_index];
+        }
+
+        // call f(slot) for all three slots, only while neither side is using the buffer
+        template<typename F>
+        void forEachSlot(F &&f) {
+            for (T &slot : slots) {
+                f(slot);
+            }
+        }
+
+    private:
+        static constexpr unsigned int index_mask = 3;
+        // set while the shared slot holds a frame the consumer has not taken
+        static constexpr unsigned int fresh = 4;
+
+        T slots[3];
+        unsigned int back_index{0};
+        // index of the slot in between, and the fresh bit
+        std::atomic<unsigned int> shared{1};
+        unsigned int front_index{2};
+    };
+}
+
+#endif //CFD_2D_TRIPLE_BUFFER_H
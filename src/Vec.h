@@ -19,9 +19,7 @@ enum VectorSize {
 template<VectorSize size>
 class Vec {
 public:
-    Vec() {
-        for (float &v: data) v = 0;
-    };
+    Vec() : data{} {};
 
     explicit Vec(float x, float y, float z = 0, float w = 0) {
         data[0] = x;
@@ -34,13 +32,10 @@ public:
         }
     };
 
-    Vec &operator=(const Vec &other) noexcept {
-        if (&other == this) return *this;
-        unsigned int i = 0;
-        for (float v: other.data)
-            data[i++] = v;
-        return *this;
-    }
+    // trivially copyable, so arrays of Vec copy as plain memory
+    Vec(const Vec &other) = default;
+
+    Vec &operator=(const Vec &other) = default;
 
     Vec operator+(Vec &V) {
         if constexpr (size == D2) {
@@ -0,0 +1,513 @@
+//
+// headless batch runner, no window or OpenGL required
+//
+
+#include "Checkpoint.h"
+#include "Fluid2D.h"
+#include "Scenario.h"
+#include "Trajectory.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <new>
+#include <string>
+
+// heap allocations of the whole process, for --check-allocs
+static std::atomic<unsigned long> allocations{0};
+
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    std::size_t a = static_cast<std::size_t>(align);
+    if (void *p = std::aligned_alloc(a, (size + a - 1) / a * a)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+// FNV-1a over the position bits, equal hashes mean bit identical states
+static uint64_t positions_hash(const std::vector<vec2 > &positions) {
+    uint64_t hash = 1469598103934665603ull;
+    for (auto p : positions) {
+        float xy[2] = {p.x(), p.y()};
+        auto *bytes = reinterpret_cast<const unsigned char *>(xy);
+        for (size_t i = 0; i < sizeof(xy); i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+// positions after steps on a fresh solver with the given pool size, other settings as in scenario
+// workers 0 runs serially, every pass on the calling thread
+static std::vector<vec2 > run_with_workers(const Scenario &scenario, unsigned int workers, unsigned long steps) {
+    Fluid2D::Fluid2DParameters params = scenario.params;
+    params.worker_count = workers;
+    params.serial = workers == 0;
+    Fluid2D fluid(params);
+    for (auto &wall : scenario.walls) {
+        fluid.addBoundary(wall);
+    }
+    fluid.advance(steps);
+    std::vector<vec2 > positions;
+    fluid.copyPositions(positions);
+    return positions;
+}
+
+// run half of the steps, save, and finish them on another solver restored from the file
+static bool restarted_hash(const Scenario &scenario, unsigned long steps, uint64_t &hash) {
+    std::string path = (std::filesystem::temp_directory_path() / "cfd_2d_check_restart.ckp").string();
+    Fluid2D::Fluid2DParameters params = scenario.params;
+    Checkpoint checkpoint;
+    {
+        Fluid2D first(params);
+        for (auto &wall : scenario.walls) {
+            first.addBoundary(wall);
+        }
+        first.advance(steps / 2);
+        if (!checkpoint.saveAsync(first, path) || !checkpoint.wait()) {
+            std::cout << checkpoint.error() << std::endl;
+            return false;
+        }
+    }
+    Fluid2D second(params);
+    bool loaded = checkpoint.load(second, path);
+    std::filesystem::remove(path);
+    if (!loaded) {
+        std::cout << checkpoint.error() << std::endl;
+        return false;
+    }
+    second.advance(steps - steps / 2);
+    std::vector<vec2 > positions;
+    second.copyPositions(positions);
+    hash = positions_hash(positions);
+    return true;
+}
+
+// throughput of many producers and wake up latency of single tasks, for both pool queues
+static void pool_bench() {
+    const unsigned int workers = 20;
+    const int producers = 4, tasks_per_producer = 50000, latency_tasks = 2000;
+    for (auto kind : {nano_std::ThreadPool::LOCKED, nano_std::ThreadPool::LOCK_FREE}) {
+        nano_std::ThreadPool pool(workers, kind);
+        // contention: producers push tiny tasks as fast as they can
+        std::atomic<int> done{0};
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < producers; t++) {
+            threads.emplace_back([&]() {
+                for (int i = 0; i < tasks_per_producer; i++) {
+                    pool.doAsync([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        while (done.load() < producers * tasks_per_producer) {
+            std::this_thread::yield();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // latency: one task at a time, from doAsync to the task starting
+        std::vector<double> latency;
+        for (int i = 0; i < latency_tasks; i++) {
+            std::atomic<bool> ran{false};
+            double us = 0;
+            auto pushed = std::chrono::steady_clock::now();
+            pool.doAsync([&]() {
+                us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - pushed).count();
+                ran.store(true, std::memory_order_release);
+            });
+            while (!ran.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            latency.push_back(us);
+        }
+        std::sort(latency.begin(), latency.end());
+        std::cout << (kind == nano_std::ThreadPool::LOCKED ? "locked    : " : "lock free : ")
+                  << producers * tasks_per_producer / seconds << " tasks/s with " << producers << " producers, "
+                  << "latency median " << latency[latency.size() / 2] << " us, "
+                  << "p99 " << latency[latency.size() * 99 / 100] << " us" << std::endl;
+    }
+}
+
+static void usage(const char *exe) {
+    std::cout << "usage: " << exe << " [options]\n"
+              << "  --scenario <name>   scenario to load (default dam_break)\n"
+              << "  --preset <1-4>      kernel preset, same as the number keys in the viewer\n"
+              << "  --steps <n>         steps to advance (default 1000)\n"
+              << "  --particles <n>     override the particle count\n"
+              << "  --hashed-grid       index occupied cells in a hash table instead of a dense grid\n"
+              << "  --unbounded         do not keep particles inside the domain box, needs --hashed-grid\n"
+              << "  --reorder <n>       sort particles in Morton order of their cells every n steps\n"
+              << "  --h <length>        smoothing length of the kernels (default from the scenario)\n"
+              << "  --verlet-skin <s>   use Verlet neighbour lists with skin radius s\n"
+              << "  --tiles <n>         density and forces over a task graph of n x n cell tiles\n"
+              << "  --symmetric         evaluate every pair once for both particles\n"
+              << "  --separate-eos      pressure and 1 / rho in their own pass after the density\n"
+              << "  --time <t>          advance until t seconds are simulated instead of --steps\n"
+              << "  --adaptive-dt       pick the time step from the CFL, force and viscosity limits\n"
+              << "  --dt-min <dt>       smallest adaptive time step\n"
+              << "  --dt-max <dt>       largest adaptive time step\n"
+              << "  --tabulated <n>     interpolate the kernels from tables of n intervals, generic path\n"
+              << "  --locked-queue      use the mutex task queue in the worker pool\n"
+              << "  --threads <n>       solver worker threads (default one per cpu, or CFD_2D_THREADS)\n"
+              << "  --pin               pin every worker to a cpu, linux only (or CFD_2D_PIN=1)\n"
+              << "  --pool-bench        compare the pool task queues and exit\n"
+              << "  --load <path>       continue from a checkpoint instead of the scenario start\n"
+              << "  --save <path>       write a checkpoint after the run\n"
+              << "  --record <path>     write a trajectory of the run, see Trajectory\n"
+              << "  --record-every <k>  steps between two recorded frames (default 10)\n"
+              << "  --check-restart     fail unless saving halfway and loading ends bit identical\n"
+              << "  --check-parallel    fail unless this run, 1 and 7 worker runs end bit identical to a serial one\n"
+              << "  --check-allocs      fail if steps after the run allocate heap memory\n"
+              << "  --isa <name>        kernels: generic, scalar, avx2 or avx512 (default best available)\n"
+              << "available scenarios:";
+    for (auto &name : scenarioNames()) {
+        std::cout << " " << name;
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char **argv) {
+    std::string scenario_name = "dam_break";
+    int preset = 0;
+    unsigned long steps = 1000;
+    unsigned long particles = 0;
+    float verlet_skin = 0;
+    float smoothing = 0;
+    unsigned int reorder_interval = 0;
+    std::string isa = "avx512";
+    bool symmetric = false;
+    bool hashed_grid = false;
+    bool unbounded = false;
+    bool fused_eos = true;
+    double sim_time = 0;
+    bool adaptive_dt = false;
+    float dt_min = 0, dt_max = 0;
+    int table_resolution = 0;
+    bool check_allocs = false;
+    bool check_parallel = false;
+    bool check_restart = false;
+    std::string load_path, save_path;
+    std::string record_path;
+    unsigned int record_every = 10;
+    bool lock_free_queue = true;
+    unsigned int threads = 0;
+    unsigned int tile_size = 0;
+    bool pin = false;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--scenario") == 0 && has_value) {
+            scenario_name = argv[++i];
+        } else if (std::strcmp(argv[i], "--preset") == 0 && has_value) {
+            preset = std::stoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--steps") == 0 && has_value) {
+            steps = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--particles") == 0 && has_value) {
+            particles = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--h") == 0 && has_value) {
+            smoothing = std::stof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--verlet-skin") == 0 && has_value) {
+            verlet_skin = std::stof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--reorder") == 0 && has_value) {
+            reorder_interval = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--hashed-grid") == 0) {
+            hashed_grid = true;
+        } else if (std::strcmp(argv[i], "--unbounded") == 0) {
+            unbounded = true;
+        } else if (std::strcmp(argv[i], "--symmetric") == 0) {
+            symmetric = true;
+        } else if (std::strcmp(argv[i], "--separate-eos") == 0) {
+            fused_eos = false;
+        } else if (std::strcmp(argv[i], "--time") == 0 && has_value) {
+            sim_time = std::stod(argv[++i]);
+        } else if (std::strcmp(argv[i], "--adaptive-dt") == 0) {
+            adaptive_dt = true;
+        } else if (std::strcmp(argv[i], "--dt-min") == 0 && has_value) {
+            dt_min = std::stof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--dt-max") == 0 && has_value) {
+            dt_max = std::stof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--tabulated") == 0 && has_value) {
+            table_resolution = std::stoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--locked-queue") == 0) {
+            lock_free_queue = false;
+        } else if (std::strcmp(argv[i], "--tiles") == 0 && has_value) {
+            tile_size = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--threads") == 0 && has_value) {
+            threads = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--pin") == 0) {
+            pin = true;
+        } else if (std::strcmp(argv[i], "--pool-bench") == 0) {
+            pool_bench();
+            return 0;
+        } else if (std::strcmp(argv[i], "--load") == 0 && has_value) {
+            load_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--save") == 0 && has_value) {
+            save_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--record") == 0 && has_value) {
+            record_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--record-every") == 0 && has_value) {
+            record_every = std::stoul(argv[++i]);
+        } else if (std::strcmp(argv[i], "--check-restart") == 0) {
+            check_restart = true;
+        } else if (std::strcmp(argv[i], "--check-parallel") == 0) {
+            check_parallel = true;
+        } else if (std::strcmp(argv[i], "--check-allocs") == 0) {
+            check_allocs = true;
+        } else if (std::strcmp(argv[i], "--isa") == 0 && has_value) {
+            isa = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    Scenario scenario;
+    // kernel tables of --tabulated, live until every solver is gone
+    KernelTables tables;
+    if (!loadScenario(scenario_name, scenario)) {
+        std::cout << "unknown scenario " << scenario_name << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+    if (preset != 0 && !applyPreset(scenario.params, preset)) {
+        std::cout << "unknown preset " << preset << std::endl;
+        return 1;
+    }
+    if (particles > 0) {
+        scenario.params.particle_count = particles;
+    }
+    if (smoothing > 0) {
+        scenario.params.h = smoothing;
+    }
+    if (table_resolution > 0) {
+        tabulateKernels(scenario.params, table_resolution, tables);
+    }
+    if (unbounded && !hashed_grid) {
+        std::cout << "--unbounded needs --hashed-grid" << std::endl;
+        return 1;
+    }
+    scenario.params.hashed_grid = hashed_grid;
+    scenario.params.clamp_to_domain = !unbounded;
+    scenario.params.reorder_interval = reorder_interval;
+    scenario.params.verlet_skin = verlet_skin;
+    scenario.params.symmetric_pairs = symmetric;
+    scenario.params.fused_eos = fused_eos;
+    scenario.params.lock_free_queue = lock_free_queue;
+    scenario.params.worker_count = threads;
+    scenario.params.tile_size = tile_size;
+    scenario.params.pin_workers = pin;
+    scenario.params.adaptive_dt = adaptive_dt;
+    if (dt_min > 0) {
+        scenario.params.dt_min = dt_min;
+    }
+    if (dt_max > 0) {
+        scenario.params.dt_max = dt_max;
+    }
+    scenario.params.vectorize = isa != "generic";
+    if (isa == "scalar") {
+        scenario.params.kernel_isa = SimdKernels::SCALAR;
+    } else if (isa == "avx2") {
+        scenario.params.kernel_isa = SimdKernels::AVX2;
+    } else if (isa == "avx512" || isa == "generic") {
+        scenario.params.kernel_isa = SimdKernels::AVX512;
+    } else {
+        std::cout << "unknown isa " << isa << std::endl;
+        return 1;
+    }
+
+    if (!load_path.empty() && (check_parallel || check_restart)) {
+        std::cout << "--check-parallel and --check-restart run from the scenario start, not with --load" << std::endl;
+        return 1;
+    }
+
+    Checkpoint checkpoint;
+    Fluid2D fluid(scenario.params);
+    for (auto &wall : scenario.walls) {
+        fluid.addBoundary(wall);
+    }
+    if (!load_path.empty()) {
+        auto load_start = std::chrono::steady_clock::now();
+        if (!checkpoint.load(fluid, load_path)) {
+            std::cout << checkpoint.error() << std::endl;
+            return 1;
+        }
+        double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+        std::cout << "restored  : step " << fluid.state().step << " in " << load_ms << " ms" << std::endl;
+    }
+
+    std::cout << "scenario  : " << scenario.name << "\n"
+              << "particles : " << fluid.params.particle_count << "\n"
+              << "grid      : " << (hashed_grid ? "hashed" : "dense") << "\n"
+              << "workers   : " << fluid.workers() << (fluid.pinnedWorkers() > 0 ? " pinned" : "") << "\n"
+              << "time step : " << (adaptive_dt ? "adaptive" : "fixed") << "\n"
+              << "kernels   : " << (symmetric ? "symmetric" : fluid.kernelPath()) << std::endl;
+    if (table_resolution > 0) {
+        std::cout << "tables    : " << table_resolution << " intervals" << std::endl;
+    }
+
+    Trajectory::Writer recorder;
+    if (!record_path.empty()) {
+        if (!recorder.open(record_path, fluid, record_every)) {
+            std::cout << recorder.error() << std::endl;
+            return 1;
+        }
+        // the starting positions are the first frame
+        recorder.capture(fluid);
+        fluid.setStepCallback([&recorder](const Fluid2D &f) {
+            recorder.onStep(f);
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (sim_time > 0) {
+        steps = fluid.advanceTime(sim_time);
+    } else {
+        fluid.advance(steps);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double steps_per_second = double(steps) / seconds;
+    std::cout << "wall time : " << seconds << " s\n"
+              << "steps/s   : " << steps_per_second << "\n"
+              << "updates/s : " << steps_per_second * fluid.params.particle_count << "\n"
+              << "steps     : " << steps << "\n"
+              << "sim time  : " << fluid.simulatedTime() << " s\n"
+              << "last dt   : " << fluid.timeStep() << "\n"
+              << "steps/sim : " << double(steps) / fluid.simulatedTime() << std::endl;
+    if (verlet_skin > 0) {
+        std::cout << "rebuilds  : " << fluid.neighbourListRebuilds() << std::endl;
+    }
+    if (reorder_interval > 0) {
+        std::cout << "reorders  : " << fluid.reorders() << std::endl;
+    }
+
+    std::vector<vec2 > positions;
+    fluid.copyPositions(positions);
+    uint64_t hash = positions_hash(positions);
+    std::cout << "hash      : " << std::hex << hash << std::dec << std::endl;
+
+    if (recorder.isOpen()) {
+        fluid.setStepCallback(nullptr);
+        // end on the final positions
+        if (fluid.state().step % recorder.interval() != 0) {
+            recorder.capture(fluid);
+        }
+        if (!recorder.close()) {
+            std::cout << recorder.error() << std::endl;
+            return 1;
+        }
+        Trajectory::Writer::Stats stats = recorder.stats();
+        std::cout << "frames    : " << stats.written << " written, " << stats.dropped << " dropped\n"
+                  << "frame     : " << double(stats.bytes) / double(std::max(1ul, stats.written))
+                  << " bytes average, " << stats.last_frame_bytes << " bytes last, "
+                  << double(stats.raw_bytes) / double(std::max<uint64_t>(1, stats.bytes)) << "x smaller than floats\n"
+                  << "writer    : " << double(stats.bytes) / 1e6 / std::max(1e-9, stats.busy_seconds)
+                  << " MB/s, busy " << stats.busy_seconds << " s" << std::endl;
+        // the recorded final frame against the solver, off by half a quantization step at most
+        Trajectory::Reader reader;
+        std::vector<float> rx(positions.size()), ry(positions.size());
+        if (!reader.open(record_path) || reader.frames() == 0 ||
+            !reader.read(reader.frames() - 1, rx.data(), ry.data())) {
+            std::cout << "could not read back " << record_path << std::endl;
+            return 1;
+        }
+        float error = 0;
+        for (size_t i = 0; i < positions.size(); i++) {
+            error = std::max(error, std::max(std::abs(rx[i] - positions[i].x()), std::abs(ry[i] - positions[i].y())));
+        }
+        std::cout << "replay    : " << reader.frames() << " frames, max error " << error << std::endl;
+    }
+
+    if (!save_path.empty()) {
+        // the solver only waits for the copy, the file is written in the background
+        auto save_start = std::chrono::steady_clock::now();
+        bool saved = checkpoint.saveAsync(fluid, save_path);
+        auto copied = std::chrono::steady_clock::now();
+        saved = saved && checkpoint.wait();
+        auto written = std::chrono::steady_clock::now();
+        if (!saved) {
+            std::cout << checkpoint.error() << std::endl;
+            return 1;
+        }
+        std::cout << "saved     : " << checkpoint.bytes() << " bytes, solver blocked "
+                  << std::chrono::duration<double, std::milli>(copied - save_start).count() << " ms, written in "
+                  << std::chrono::duration<double, std::milli>(written - save_start).count() << " ms" << std::endl;
+    }
+
+    if (check_restart) {
+        uint64_t restarted = 0;
+        if (!restarted_hash(scenario, steps, restarted)) {
+            return 1;
+        }
+        bool same = restarted == hash;
+        std::cout << "restart   : " << (same ? "identical" : "differs") << std::endl;
+        if (!same) {
+            return 1;
+        }
+    }
+
+    if (check_parallel) {
+        // a serial run is the reference, this run, one worker and more workers than cores
+        // must end the same, every chunking must agree.
+        // The pool size is the point of the check, keep the environment from overriding it
+        unsetenv("CFD_2D_THREADS");
+        uint64_t serial = positions_hash(run_with_workers(scenario, 0, steps));
+        bool same = serial == hash;
+        std::cout << "parallel  : this run " << (same ? "identical" : "differs") << " to serial" << std::endl;
+        if (!same) {
+            return 1;
+        }
+        for (unsigned int workers : {1u, 7u}) {
+            same = positions_hash(run_with_workers(scenario, workers, steps)) == serial;
+            std::cout << "parallel  : " << workers << (workers == 1 ? " worker " : " workers ")
+                      << (same ? "identical" : "differs") << " to serial" << std::endl;
+            if (!same) {
+                return 1;
+            }
+        }
+    }
+
+    if (check_allocs) {
+        // the run above is the warm up, buffers have their steady state sizes
+        const unsigned int check_steps = 10;
+        unsigned long before = allocations.load();
+        fluid.advance(check_steps);
+        unsigned long count = allocations.load() - before;
+        std::cout << "allocs    : " << count << " in " << check_steps << " steps" << std::endl;
+        if (count != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,14 +1,9 @@
 #include "GLWindow.h"
 #include "GLRenderable.h"
-#include "Fluid2D.h"
-#include "LineBoundary.h"
-#include <random>
-
-// define H to use default IMPL
-#ifndef KERNEL_WITH_H
-#define KERNEL_WITH_H 1.f
-#include "SmoothKernels.h"
-#endif
+#include "Fluid2DRenderer.h"
+#include "LineBoundaryRenderer.h"
+#include "ReplayRenderer.h"
+#include "Scenario.h"
 
 using namespace std;
 const float axis_short_size = 8;
@@ -17,24 +12,8 @@ const float axis_short_size = 8;
 const int width = 800;
 const int height = 800;
 
-// init location of the liquid
-const float init_x = 2;
-const float init_y = 4;
-const float init_w = 2;
-const float init_h = 3;
-
 // grid info
 const float grid_size = 10;
-// particle count of each unit area
-const int p_cnt_per_u = int(16 * 10000 / grid_size / grid_size);
-
-// simulation params
-const float rho_0 = 18;
-const float K = 1;
-const float miu = 0.3;
-const float sigma = 0.05;
-const vec2 G(0, -0.5);
-const float dt = 0.05;
 
 struct coords_painter final : public GLRenderableI {
     float width;
@@ -68,45 +47,6 @@ struct coords_painter final : public GLRenderableI {
 
 
 
-Fluid2D::Fluid2DParameters basic_params() {
-    Fluid2D::Fluid2DParameters params;
-    params.delta_t = dt;
-    params.top = height / grid_size;
-    params.bottom = 0;
-    params.left = 0;
-    params.right = width / grid_size;
-    params.rho_0 = rho_0;
-    params.K = K;
-    params.V = miu;
-    params.sigma = sigma;
-    params.particle_count = int(p_cnt_per_u * init_w * init_h);
-    params.gravity = G;
-    params.rho_kernel = &Poly6<D2>();
-    params.pressure_kernel = &DebrunSpiky<D2>();
-    params.viscosity_kernel = &Viscosity<D2>();
-    params.surface_tension_kernel = &Poly6<D2>();
-    params.h = H;
-    params.init_positions = [](std::vector<Vec<D2>> &positions, float t, float b, float l, float r) {
-        float unit_size = std::min((r - l), (t - b)) / axis_short_size;
-        float unit_count = std::sqrt(float(positions.size()) / (init_w * init_h));
-        float step_size = 1.f / unit_count;
-        int width = std::ceil(unit_count * init_w), height = std::ceil(unit_count * init_h);
-        for (int dx = 0; dx < width; dx++) {
-            for (int dy = 0; dy < height; dy++) {
-                int index = dy * width + dx;
-                if (index >= positions.size()) return;
-                positions[index].x() = l + unit_size * (float(dx) * step_size + 0.5 * step_size + init_x);
-                positions[index].y() = b + unit_size * (float(dy) * step_size + 0.5 * step_size + init_y);
-            }
-        }
-//        for (auto &p: positions) {
-//            p.x() = unit_size * ((float(std::rand()) / float(RAND_MAX) * init_w + init_x)) + l;
-//            p.y() = unit_size * ((float(std::rand()) / float(RAND_MAX) * init_h + init_y)) + b;
-//        }
-    };
-    return params;
-}
-
 // a handler used for switching case
 class EventHandler final : public GLWindowEventHandler {
 private:
@@ -121,52 +61,11 @@ public:
             } else {
                 f->start();
             }
-        } else if (key == GLFW_KEY_1) {
-            f->resetWithCallback([this]() {
-                if (!f->isRunning()) {
-                    //f->params.delta_t = 0.01;
-                    f->params.pressure_kernel = &Poly6<D2>();
-                    f->params.viscosity_kernel = nullptr;
-                    f->params.surface_tension_kernel = nullptr;
-                    f->params.K = 0.2;
-                    f->params.V = 0;
-                    f->params.sigma = 0;
-                }
-            });
-        } else if (key == GLFW_KEY_2) {
-            f->resetWithCallback([this]() {
-                if (!f->isRunning()) {
-                    //f->params.delta_t = 0.01;
-                    f->params.pressure_kernel = &DebrunSpiky<D2>();
-                    f->params.viscosity_kernel = nullptr;
-                    f->params.surface_tension_kernel = nullptr;
-                    f->params.K = 0.2;
-                    f->params.V = 0;
-                    f->params.sigma = 0;
-                }
-            });
-        } else if (key == GLFW_KEY_3) {
-            f->resetWithCallback([this]() {
-                if (!f->isRunning()) {
-                    f->params.delta_t = dt;
-                    f->params.pressure_kernel = &DebrunSpiky<D2>();
-                    f->params.viscosity_kernel = &Viscosity<D2>();
-                    f->params.surface_tension_kernel = nullptr;
-                    f->params.K = K;
-                    f->params.V = miu;
-                    f->params.sigma = 0;
-                }
-            });
-        } else if (key == GLFW_KEY_4) {
-            f->resetWithCallback([this]() {
+        } else if (key >= GLFW_KEY_1 && key <= GLFW_KEY_4) {
+            int preset = key - GLFW_KEY_1 + 1;
+            f->resetWithCallback([this, preset]() {
                 if (!f->isRunning()) {
-                    f->params.delta_t = dt;
-                    f->params.pressure_kernel = &DebrunSpiky<D2>();
-                    f->params.viscosity_kernel = &Viscosity<D2>();
-                    f->params.surface_tension_kernel = &Poly6<D2>();
-                    f->params.K = K;
-                    f->params.V = miu;
-                    f->params.sigma = sigma;
+                    applyPreset(f->params, preset);
                 }
             });
         }
@@ -177,31 +76,99 @@ public:
     }
 };
 
-int main(int, char **) {
+// keys of the replay mode
+class ReplayHandler final : public GLWindowEventHandler {
+private:
+    std::shared_ptr<ReplayRenderer> r;
+
+    void print() {
+        std::cout << "frame " << r->frame() + 1 << " / " << r->frames() << ", step " << r->step()
+                  << ", t = " << r->time() << ", speed x" << r->playSpeed()
+                  << (r->isPaused() ? ", paused" : "") << std::endl;
+    }
+
+public:
+    explicit ReplayHandler(std::shared_ptr<ReplayRenderer> &replay) : r(replay) {}
+
+    void keyDown(GLWindow *window, int key) override {
+        long jump = long(r->isPaused() ? 1 : r->keyInterval());
+        if (key == GLFW_KEY_SPACE) {
+            r->togglePause();
+        } else if (key == GLFW_KEY_RIGHT) {
+            r->seek(jump);
+        } else if (key == GLFW_KEY_LEFT) {
+            r->seek(-jump);
+        } else if (key == GLFW_KEY_UP) {
+            r->faster();
+        } else if (key == GLFW_KEY_DOWN) {
+            r->slower();
+        } else if (key == GLFW_KEY_HOME) {
+            r->seekTo(0);
+        } else if (key == GLFW_KEY_END) {
+            r->seekTo(r->frames() - 1);
+        } else {
+            return;
+        }
+        print();
+    }
+
+    void keyUp(GLWindow *window, int key) override {
+        // do nothing
+    }
+};
+
+// show a recorded trajectory, no solver is created
+static int replay(const char *path) {
+    auto replay = std::make_shared<ReplayRenderer>();
+    if (!replay->open(path)) {
+        std::cout << "cannot replay " << path << ": " << replay->error() << std::endl;
+        return 1;
+    }
+    replay->setScale(2.f * grid_size / float(std::min(width, height)));
+    std::cout << path << ": " << replay->frames() << " frames. space: pause, left / right: seek, "
+              << "up / down: speed, home / end: first / last frame" << std::endl;
+
+    GLWindow window(width, height, "SPH 2D replay");
+    std::shared_ptr<ReplayHandler> handler = std::make_shared<ReplayHandler>(replay);
+    if (window.isValid()) {
+        window.setBackgroundColor(0.1, 0.05, 0.1);
+        window.addRenderObject(std::make_shared<coords_painter>(width, height,
+                                                                float(std::min(width, height)) / axis_short_size));
+        window.addRenderObject(replay);
+        for (auto &wall : replay->walls()) {
+            auto line = std::make_shared<LineBoundary>(wall.start_x, wall.start_y, wall.end_x, wall.end_y, wall.damp);
+            window.addRenderObject(std::make_shared<LineBoundaryRenderer>(line));
+        }
+        window.updateFPS(60);
+        window.delegate = handler;
+        return window.run();
+    } else {
+        std::cout << "Error occurs when window created" << std::endl;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    // CFD_2D --replay run.trj plays a recording of CFD_2D_headless --record back
+    if (argc == 3 && std::string(argv[1]) == "--replay") {
+        return replay(argv[2]);
+    }
     float unit_size = float(std::min(width, height)) / axis_short_size;
 
+    Scenario scenario;
+    loadScenario("dam_break", scenario);
     // my fluid
-    Fluid2D::Fluid2DParameters params = basic_params();
-    // init fluid
-    auto fluid = std::make_shared<Fluid2D>(params);
-    fluid->setScale(2.f * grid_size / float(std::min(width, height)));
+    auto fluid = std::make_shared<Fluid2D>(scenario.params);
+    auto fluid_renderer = std::make_shared<Fluid2DRenderer>(fluid);
+    fluid_renderer->setScale(2.f * grid_size / float(std::min(width, height)));
 
     // other objects
     auto coords = std::make_shared<coords_painter>(width, height, unit_size);
 
     // walls
-    float i = 1.f / axis_short_size;
-    float damp = 0.1;
-    std::shared_ptr<LineBoundary> wall_bottom = std::make_shared<LineBoundary>(i * 1, 0.0001, i * 6, 0.0001, damp);
-    std::shared_ptr<LineBoundary> wall_left = std::make_shared<LineBoundary>(i * 1, 0.0001, i * 1, i * 5, damp);
-    std::shared_ptr<LineBoundary> wall_right = std::make_shared<LineBoundary>(i * 6, 0.0001, i * 6, i * 5, damp);
-//    std::shared_ptr<LineBoundary> wall = std::make_shared<LineBoundary>(i * 2.5, i * 3, i * 3, i * 3.5, damp);
-//    std::shared_ptr<LineBoundary> wall2 = std::make_shared<LineBoundary>(i * 3, i * 3.5, i * 3.5, i * 3, damp);
-    fluid->addBoundary(wall_left);
-    fluid->addBoundary(wall_right);
-    fluid->addBoundary(wall_bottom);
-//    fluid->addBoundary(wall);
-//    fluid->addBoundary(wall2);
+    for (auto &wall : scenario.walls) {
+        fluid->addBoundary(wall);
+    }
 
     // build window
     GLWindow window(width, height, "SPH 2D");
@@ -210,12 +177,10 @@ int main(int, char **) {
     if (window.isValid()) {
         window.setBackgroundColor(0.1, 0.05, 0.1);
         window.addRenderObject(coords);
-        window.addRenderObject(fluid);
-        window.addRenderObject(wall_left);
-        window.addRenderObject(wall_right);
-        window.addRenderObject(wall_bottom);
-//        window.addRenderObject(wall);
-//        window.addRenderObject(wall2);
+        window.addRenderObject(fluid_renderer);
+        for (auto &wall : scenario.walls) {
+            window.addRenderObject(std::make_shared<LineBoundaryRenderer>(wall));
+        }
         window.updateFPS(120);
         window.delegate = handler;
         return window.run();